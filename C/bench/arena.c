@@ -0,0 +1,128 @@
+// 区域分配对比逐个 malloc/free：每轮分配一批 16~128 字节的对象（像解析一条
+// 命令行），用完一起释放。mark-rollback 在每轮里再套一层临时对象，处理完
+// 一个词就回滚。链接 libmemalloc.so，三种方式用的都是 memalloc
+#define _DEFAULT_SOURCE
+#include <stdlib.h>
+
+#include "../memalloc.h"
+#include "bench.h"
+
+#define OBJECTS 256 // 每轮的对象数
+#define SCRATCH 4   // mark-rollback 每个对象附带的临时对象数
+#define ROUNDS 100000
+
+static uint64_t rng = 88172645463325252ULL;
+
+static uint64_t next_rand(void) {
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return rng;
+}
+
+static size_t pick_size(void) {
+    return 16 + next_rand() % 113;
+}
+
+// 每轮记一次平均每个对象的耗时（含释放）
+static void round_done(bench_hist_t *hist, uint64_t t0, unsigned objects) {
+    bench_hist_add(hist, (bench_now() - t0) / objects);
+}
+
+static void run_malloc(void) {
+    static char *obj[OBJECTS];
+    bench_hist_t hist;
+    memset(&hist, 0, sizeof(hist));
+    uint64_t start = bench_now();
+    for (int round = 0; round < ROUNDS; round++) {
+        uint64_t t0 = bench_now();
+        for (unsigned i = 0; i < OBJECTS; i++) {
+            obj[i] = malloc(pick_size());
+            obj[i][0] = 1;
+        }
+        for (unsigned i = 0; i < OBJECTS; i++)
+            free(obj[i]);
+        round_done(&hist, t0, OBJECTS);
+    }
+    bench_report("arena/malloc-free", (uint64_t)ROUNDS * OBJECTS, bench_now() - start, &hist);
+}
+
+static void run_reset(void) {
+    static char *obj[OBJECTS];
+    bench_hist_t hist;
+    memset(&hist, 0, sizeof(hist));
+    memalloc_arena_t *arena = memalloc_arena_create(0);
+    uint64_t start = bench_now();
+    for (int round = 0; round < ROUNDS; round++) {
+        uint64_t t0 = bench_now();
+        for (unsigned i = 0; i < OBJECTS; i++) {
+            obj[i] = memalloc_arena_alloc(arena, pick_size());
+            obj[i][0] = 1;
+        }
+        memalloc_arena_reset(arena);
+        round_done(&hist, t0, OBJECTS);
+    }
+    bench_report("arena/bump-reset", (uint64_t)ROUNDS * OBJECTS, bench_now() - start, &hist);
+    memalloc_arena_destroy(arena);
+}
+
+// 对照组：临时对象同样逐个 malloc/free
+static void run_scratch_malloc(void) {
+    static char *obj[OBJECTS], *tmp[SCRATCH];
+    bench_hist_t hist;
+    memset(&hist, 0, sizeof(hist));
+    uint64_t start = bench_now();
+    for (int round = 0; round < ROUNDS / 4; round++) {
+        uint64_t t0 = bench_now();
+        for (unsigned i = 0; i < OBJECTS; i++) {
+            for (unsigned j = 0; j < SCRATCH; j++) {
+                tmp[j] = malloc(pick_size());
+                tmp[j][0] = 1;
+            }
+            obj[i] = malloc(pick_size());
+            obj[i][0] = 1;
+            for (unsigned j = 0; j < SCRATCH; j++)
+                free(tmp[j]);
+        }
+        for (unsigned i = 0; i < OBJECTS; i++)
+            free(obj[i]);
+        round_done(&hist, t0, OBJECTS * (SCRATCH + 1));
+    }
+    bench_report("arena/scratch-malloc", (uint64_t)ROUNDS / 4 * OBJECTS * (SCRATCH + 1),
+                 bench_now() - start, &hist);
+}
+
+static void run_rollback(void) {
+    static char *obj[OBJECTS];
+    bench_hist_t hist;
+    memset(&hist, 0, sizeof(hist));
+    memalloc_arena_t *arena = memalloc_arena_create(0), *scratch = memalloc_arena_create(0);
+    uint64_t start = bench_now();
+    for (int round = 0; round < ROUNDS / 4; round++) {
+        uint64_t t0 = bench_now();
+        for (unsigned i = 0; i < OBJECTS; i++) {
+            memalloc_arena_mark_t mark = memalloc_arena_mark(scratch);
+            for (unsigned j = 0; j < SCRATCH; j++) {
+                char *tmp = memalloc_arena_alloc(scratch, pick_size());
+                tmp[0] = 1;
+            }
+            obj[i] = memalloc_arena_alloc(arena, pick_size());
+            obj[i][0] = 1;
+            memalloc_arena_rollback(scratch, mark);
+        }
+        memalloc_arena_reset(arena);
+        round_done(&hist, t0, OBJECTS * (SCRATCH + 1));
+    }
+    bench_report("arena/mark-rollback", (uint64_t)ROUNDS / 4 * OBJECTS * (SCRATCH + 1),
+                 bench_now() - start, &hist);
+    memalloc_arena_destroy(scratch);
+    memalloc_arena_destroy(arena);
+}
+
+int main(void) {
+    run_malloc();
+    run_reset();
+    run_scratch_malloc();
+    run_rollback();
+    return 0;
+}
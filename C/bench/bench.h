@@ -0,0 +1,82 @@
+// 基准程序共用：计时、延迟直方图、峰值 rss 和统一格式的结果行。
+// 每个基准分别用系统分配器和 memalloc 跑一遍，见 bench/run.sh
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+
+// 延迟直方图：64ns 以内每纳秒一格，之后每个 2 的幂分 16 格
+#define BENCH_BUCKETS (64 + 40 * 16)
+// 每多少次操作计一次时，计时本身的开销不至于拖慢吞吐
+#define BENCH_TIME_EVERY 16
+
+typedef struct bench_hist {
+    uint64_t count[BENCH_BUCKETS];
+    uint64_t n;
+    uint64_t max; // 精确的最大值，格只有下界
+} bench_hist_t;
+
+static inline uint64_t bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static inline unsigned bench_bucket(uint64_t ns) {
+    if (ns < 64)
+        return ns;
+    unsigned e = 63 - __builtin_clzll(ns);
+    unsigned idx = 64 + (e - 6) * 16 + ((ns >> (e - 4)) & 15);
+    return idx < BENCH_BUCKETS ? idx : BENCH_BUCKETS - 1;
+}
+
+// 格的下界
+static inline uint64_t bench_bucket_ns(unsigned idx) {
+    if (idx < 64)
+        return idx;
+    unsigned e = (idx - 64) / 16 + 6;
+    return ((uint64_t)16 + (idx - 64) % 16) << (e - 4);
+}
+
+static inline void bench_hist_add(bench_hist_t *h, uint64_t ns) {
+    h->count[bench_bucket(ns)]++;
+    h->n++;
+    if (ns > h->max)
+        h->max = ns;
+}
+
+static inline void bench_hist_merge(bench_hist_t *into, const bench_hist_t *from) {
+    for (unsigned i = 0; i < BENCH_BUCKETS; i++)
+        into->count[i] += from->count[i];
+    into->n += from->n;
+    if (from->max > into->max)
+        into->max = from->max;
+}
+
+static inline uint64_t bench_hist_pct(const bench_hist_t *h, double pct) {
+    uint64_t want = (uint64_t)(h->n * pct), seen = 0;
+    for (unsigned i = 0; i < BENCH_BUCKETS; i++) {
+        seen += h->count[i];
+        if (seen > want)
+            return bench_bucket_ns(i);
+    }
+    return 0;
+}
+
+static inline double bench_peak_rss_mb(void) {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_maxrss / 1024.0;
+}
+
+static inline void bench_report(const char *name, uint64_t ops, uint64_t ns, const bench_hist_t *h) {
+    printf("%-22s %9.2f Mops/s  p99 %7llu ns  peak rss %8.1f MB\n", name, ops * 1e3 / ns,
+           (unsigned long long)bench_hist_pct(h, 0.99), bench_peak_rss_mb());
+    fflush(stdout);
+}
+
+#endif
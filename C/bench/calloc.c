@@ -0,0 +1,102 @@
+// calloc 基准：
+//   sparse-8M   反复 calloc 一张 8M 的表，只写其中几十个页（像稀疏的哈希表）
+//   reuse-1M    64K~1M 的块写满后释放，下一次 calloc 拿到的多半是用过的内存
+//   small       16~1K 的小块，calloc 后写满
+// 大块一次要几十微秒，按每次的平均耗时（含之后写内存）报告；直方图只记 calloc 本身。
+// 表没写到的页不该被提前缺页，所以也看峰值 rss
+#define _DEFAULT_SOURCE
+#include <stdlib.h>
+
+#include "bench.h"
+
+#define SPARSE_OPS 2000
+#define SPARSE_SIZE (8 << 20)
+#define REUSE_SLOTS 64
+#define REUSE_OPS 50000
+#define SMALL_SLOTS 4096
+#define SMALL_OPS 10000000
+
+static uint64_t rng = 88172645463325252ULL;
+static void *volatile sink; // 否则编译器会把成对的 calloc/free 整个删掉
+
+static void report(const char *name, uint64_t ops, uint64_t ns, const bench_hist_t *h) {
+    printf("%-22s %9.2f us/op  p99 %7llu ns  peak rss %8.1f MB\n", name, ns / 1e3 / ops,
+           (unsigned long long)bench_hist_pct(h, 0.99), bench_peak_rss_mb());
+    fflush(stdout);
+}
+
+static uint64_t next_rand(void) {
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return rng;
+}
+
+static void run_sparse(void) {
+    bench_hist_t hist;
+    memset(&hist, 0, sizeof(hist));
+    uint64_t start = bench_now();
+    for (int i = 0; i < SPARSE_OPS; i++) {
+        uint64_t t0 = bench_now();
+        char *table = calloc(1, SPARSE_SIZE);
+        bench_hist_add(&hist, bench_now() - t0);
+        for (int j = 0; j < 32; j++)
+            table[next_rand() % SPARSE_SIZE]++;
+        sink = table;
+        free(table);
+    }
+    report("calloc/sparse-8M", SPARSE_OPS, bench_now() - start, &hist);
+}
+
+static void run_reuse(void) {
+    static char *slot[REUSE_SLOTS];
+    bench_hist_t hist;
+    memset(&hist, 0, sizeof(hist));
+    uint64_t start = bench_now();
+    for (int i = 0; i < REUSE_OPS; i++) {
+        unsigned k = next_rand() % REUSE_SLOTS;
+        free(slot[k]);
+        size_t n = 65536 + next_rand() % (1 << 20);
+        uint64_t t0 = bench_now();
+        slot[k] = calloc(1, n);
+        bench_hist_add(&hist, bench_now() - t0);
+        memset(slot[k], 1, n);
+    }
+    uint64_t ns = bench_now() - start;
+    for (unsigned k = 0; k < REUSE_SLOTS; k++) {
+        free(slot[k]);
+        slot[k] = NULL;
+    }
+    report("calloc/reuse-1M", REUSE_OPS, ns, &hist);
+}
+
+static void run_small(void) {
+    static char *slot[SMALL_SLOTS];
+    bench_hist_t hist;
+    memset(&hist, 0, sizeof(hist));
+    uint64_t start = bench_now();
+    for (uint64_t i = 0; i < SMALL_OPS; i++) {
+        uint64_t r = next_rand();
+        unsigned k = r % SMALL_SLOTS;
+        uint64_t t0 = i % BENCH_TIME_EVERY == 0 ? bench_now() : 0;
+        free(slot[k]);
+        size_t n = 16 + (r >> 16) % 1008;
+        slot[k] = calloc(1, n);
+        if (t0)
+            bench_hist_add(&hist, bench_now() - t0);
+        slot[k][n - 1] = 1;
+    }
+    uint64_t ns = bench_now() - start;
+    for (unsigned k = 0; k < SMALL_SLOTS; k++) {
+        free(slot[k]);
+        slot[k] = NULL;
+    }
+    report("calloc/small", SMALL_OPS, ns, &hist);
+}
+
+int main(void) {
+    run_sparse();
+    run_reuse();
+    run_small();
+    return 0;
+}
@@ -0,0 +1,122 @@
+// 端到端：把真实程序作为子进程跑完，报告墙钟时间和子进程的峰值 rss。
+// 分配器由调用者通过 LD_PRELOAD 指定，子进程继承。
+//   e2e shell <脚本> <shell>        脚本经管道喂给 shell 的标准输入
+//   e2e kilo <文件> <kilo>          在伪终端里打开文件，翻页、搜索、编辑后不保存退出
+#define _DEFAULT_SOURCE
+#include <fcntl.h>
+#include <poll.h>
+#include <pty.h>
+#include <stdlib.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+// CTRL(k) 来自 <termios.h>
+
+// 把伪终端那头的输出读掉，免得子进程写满缓冲区阻塞；等到 ms 毫秒没有输出为止
+static void drain(int fd, int ms) {
+    char buf[65536];
+    struct pollfd p = {fd, POLLIN, 0};
+    while (poll(&p, 1, ms) > 0) {
+        if (read(fd, buf, sizeof(buf)) <= 0)
+            break;
+    }
+}
+
+static void send_keys(int fd, const char *keys, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, keys, len);
+        if (n <= 0)
+            return;
+        keys += n;
+        len -= n;
+        drain(fd, 0);
+    }
+}
+
+static pid_t run_kilo(const char *file, const char *kilo, int *master, uint64_t *keys) {
+    struct winsize ws = {40, 120, 0, 0};
+    pid_t pid = forkpty(master, NULL, NULL, &ws);
+    if (pid == 0) {
+        execl(kilo, kilo, file, (char *)NULL);
+        _exit(127);
+    }
+    if (pid < 0)
+        return -1;
+    drain(*master, 200); // 第一屏
+    static const char page_down[] = "\x1b[6~", page_up[] = "\x1b[5~";
+    for (int i = 0; i < 400; i++) {
+        send_keys(*master, page_down, sizeof(page_down) - 1);
+        drain(*master, 0);
+    }
+    for (int i = 0; i < 200; i++)
+        send_keys(*master, page_up, sizeof(page_up) - 1);
+    // 搜索并在命中处输入一段文字
+    static const char edit[] = {CTRL('f'), 'l', 'i', 'n', 'e', ' ', '9', '9', '9', '\r'};
+    send_keys(*master, edit, sizeof(edit));
+    for (int i = 0; i < 2000; i++)
+        send_keys(*master, "abc ", 4);
+    *keys = 400 + 200 + sizeof(edit) + 2000 * 4;
+    drain(*master, 100);
+    // 有修改时要连按 Ctrl-Q
+    for (int i = 0; i < 4; i++) {
+        char q = CTRL('q');
+        send_keys(*master, &q, 1);
+        drain(*master, 20);
+    }
+    return pid;
+}
+
+static pid_t run_shell(const char *script, const char *shell, int *out, uint64_t *lines) {
+    int in = open(script, O_RDONLY);
+    if (in == -1)
+        return -1;
+    *lines = 0;
+    char buf[65536];
+    ssize_t n;
+    while ((n = read(in, buf, sizeof(buf))) > 0)
+        for (ssize_t i = 0; i < n; i++)
+            *lines += buf[i] == '\n';
+    lseek(in, 0, SEEK_SET);
+    int fds[2];
+    if (pipe(fds) == -1)
+        return -1;
+    pid_t pid = fork();
+    if (pid == 0) {
+        dup2(in, STDIN_FILENO);
+        dup2(fds[1], STDOUT_FILENO);
+        execl(shell, shell, (char *)NULL);
+        _exit(127);
+    }
+    close(in);
+    close(fds[1]);
+    *out = fds[0];
+    return pid;
+}
+
+int main(int argc, char **argv) {
+    if (argc != 4) {
+        fprintf(stderr, "usage: e2e shell <script> <shell> | e2e kilo <file> <kilo>\n");
+        return 2;
+    }
+    int fd = -1;
+    uint64_t ops = 0, start = bench_now();
+    pid_t pid = strcmp(argv[1], "kilo") == 0 ? run_kilo(argv[2], argv[3], &fd, &ops)
+                                              : run_shell(argv[2], argv[3], &fd, &ops);
+    if (pid < 0) {
+        perror("e2e");
+        return 1;
+    }
+    drain(fd, 1000);
+    int status;
+    struct rusage ru;
+    wait4(pid, &status, 0, &ru);
+    uint64_t ns = bench_now() - start;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        fprintf(stderr, "e2e: %s exited abnormally (status %d)\n", argv[3], status);
+    printf("%-22s %9.3f s  %10llu ops      peak rss %8.1f MB\n", argv[1], ns / 1e9,
+           (unsigned long long)ops, ru.ru_maxrss / 1024.0);
+    return 0;
+}
@@ -0,0 +1,104 @@
+// 碎片基准：多轮随机分配/释放，每轮换一种大小分布，对比堆的峰值与同时
+// 存活的字节数
+#define _DEFAULT_SOURCE
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+#define SLOTS 100000
+#define ROUNDS 12
+#define OPS_PER_ROUND 1000000
+
+static uint64_t rng = 88172645463325252ULL;
+
+static uint64_t next_rand(void) {
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return rng;
+}
+
+// 每轮的大小分布：小对象、中等缓冲区、混入大块
+static size_t pick_size(int round) {
+    uint64_t r = next_rand();
+    switch (round % 3) {
+    case 0:
+        return 16 + r % 112;
+    case 1:
+        return 1024 + r % 7168;
+    default:
+        return r % 100 < 95 ? 16 + r % 4096 : 65536 + r % 458752;
+    }
+}
+
+static size_t resident_bytes(void) {
+    long pages = 0, resident = 0;
+    FILE *fp = fopen("/proc/self/statm", "r");
+    if (fp) {
+        if (fscanf(fp, "%ld %ld", &pages, &resident) != 2)
+            resident = 0;
+        fclose(fp);
+    }
+    return (size_t)resident * sysconf(_SC_PAGESIZE);
+}
+
+int main(void) {
+    static char *slot[SLOTS];
+    static size_t slot_size[SLOTS];
+    char *brk_start = sbrk(0);
+    size_t live = 0, peak_live = 0, peak_rss = 0, peak_brk = 0;
+    bench_hist_t hist;
+    memset(&hist, 0, sizeof(hist));
+    uint64_t busy = 0; // 只算分配和释放本身，不算写内存
+
+    printf("%5s %10s %10s %10s\n", "round", "live MB", "brk MB", "rss MB");
+    for (int round = 0; round < ROUNDS; round++) {
+        for (int op = 0; op < OPS_PER_ROUND; op++) {
+            int k = next_rand() % SLOTS;
+            uint64_t t0 = bench_now();
+            if (slot[k]) {
+                live -= slot_size[k];
+                free(slot[k]);
+                slot[k] = NULL;
+                uint64_t dt = bench_now() - t0;
+                busy += dt;
+                if (op % BENCH_TIME_EVERY == 0)
+                    bench_hist_add(&hist, dt);
+                continue;
+            }
+            size_t n = pick_size(round);
+            slot[k] = malloc(n);
+            uint64_t dt = bench_now() - t0;
+            busy += dt;
+            if (op % BENCH_TIME_EVERY == 0)
+                bench_hist_add(&hist, dt);
+            if (slot[k] == NULL) {
+                fprintf(stderr, "malloc(%zu) failed\n", n);
+                return 1;
+            }
+            memset(slot[k], 0x5a, n); // 全部写一遍，RSS 才反映真实占用
+            slot_size[k] = n;
+            live += n;
+            if (live > peak_live)
+                peak_live = live;
+        }
+        size_t rss = resident_bytes();
+        size_t heap = (char *)sbrk(0) - brk_start;
+        if (rss > peak_rss)
+            peak_rss = rss;
+        if (heap > peak_brk)
+            peak_brk = heap;
+        printf("%5d %10.1f %10.1f %10.1f\n", round, live / 1048576.0,
+               heap / 1048576.0, rss / 1048576.0);
+    }
+    for (int k = 0; k < SLOTS; k++)
+        free(slot[k]);
+
+    printf("peak live %.1f MB, peak brk %.1f MB, peak rss %.1f MB, "
+           "rss / live %.2f\n",
+           peak_live / 1048576.0, peak_brk / 1048576.0, peak_rss / 1048576.0,
+           (double)peak_rss / peak_live);
+    bench_report("frag", (uint64_t)ROUNDS * OPS_PER_ROUND, busy, &hist);
+    return 0;
+}
@@ -0,0 +1,75 @@
+// realloc 增长：像 abuf_append 那样每次只多要一点，分别测单个缓冲区一路
+// 长到 64M，以及 64 个缓冲区交替增长到随机大小后释放重来
+#define _DEFAULT_SOURCE
+#include <stdlib.h>
+
+#include "bench.h"
+
+#define BUFFERS 64
+#define OPS 2000000
+
+static uint64_t rng = 88172645463325252ULL;
+
+static uint64_t next_rand(void) {
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return rng;
+}
+
+static void grow_one(void) {
+    bench_hist_t hist;
+    memset(&hist, 0, sizeof(hist));
+    char *buf = NULL;
+    size_t len = 0;
+    uint64_t ops = 0, start = bench_now();
+    while (len < (64 << 20)) {
+        size_t n = 16 + next_rand() % 113;
+        uint64_t t0 = ops % BENCH_TIME_EVERY == 0 ? bench_now() : 0;
+        buf = realloc(buf, len + n);
+        if (t0)
+            bench_hist_add(&hist, bench_now() - t0);
+        memset(buf + len, 'x', n);
+        len += n;
+        ops++;
+    }
+    uint64_t ns = bench_now() - start;
+    free(buf);
+    bench_report("grow/one-to-64M", ops, ns, &hist);
+}
+
+static void grow_many(void) {
+    static char *buf[BUFFERS];
+    static size_t len[BUFFERS], target[BUFFERS];
+    bench_hist_t hist;
+    memset(&hist, 0, sizeof(hist));
+    uint64_t start = bench_now();
+    for (uint64_t i = 0; i < OPS; i++) {
+        uint64_t r = next_rand();
+        unsigned k = r % BUFFERS;
+        if (len[k] >= target[k]) {
+            free(buf[k]);
+            buf[k] = NULL;
+            len[k] = 0;
+            target[k] = 256 + (r >> 20) % (1 << ((r >> 8) % 4 ? 14 : 22)); // 多数 16K 以内
+            continue;
+        }
+        size_t n = 16 + (r >> 32) % 113;
+        uint64_t t0 = i % BENCH_TIME_EVERY == 0 ? bench_now() : 0;
+        buf[k] = realloc(buf[k], len[k] + n);
+        if (t0)
+            bench_hist_add(&hist, bench_now() - t0);
+        buf[k][len[k]] = 'x';
+        len[k] += n;
+    }
+    uint64_t ns = bench_now() - start;
+    for (unsigned k = 0; k < BUFFERS; k++)
+        free(buf[k]);
+    bench_report("grow/64-buffers", OPS, ns, &hist);
+}
+
+int main(void) {
+    grow_one();
+    grow_many();
+    return 0;
+}
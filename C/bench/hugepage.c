@@ -0,0 +1,94 @@
+// 大页基准：大堆上的随机访问受 TLB 未命中拖累，用 MEMALLOC_HUGEPAGE 对比。
+//   lookup   16 张 32M 的表，按上一次读到的值决定下一次读哪里（指针追逐）
+//   grow     realloc 一个缓冲区从 1M 每次长 1M 到 256M，每次写满新长出的部分
+// grow 每次要几十微秒，按每次的平均耗时报告。每项后面打印 /proc/self/smaps_rollup
+// 里的 AnonHugePages，看有多少内存落在大页上
+#define _DEFAULT_SOURCE
+#include <stdlib.h>
+
+#include "bench.h"
+
+#define TABLES 16
+#define TABLE_SIZE (32 << 20)
+#define LOOKUPS 20000000
+#define BATCH 1024
+#define GROW_STEP (1 << 20)
+#define GROW_MAX (256 << 20)
+
+static uint64_t rng = 88172645463325252ULL;
+
+static uint64_t next_rand(void) {
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return rng;
+}
+
+static void report_huge(void) {
+    FILE *f = fopen("/proc/self/smaps_rollup", "r");
+    char line[256];
+    long kb = -1;
+    while (f && fgets(line, sizeof(line), f))
+        if (sscanf(line, "AnonHugePages: %ld kB", &kb) == 1)
+            break;
+    if (f)
+        fclose(f);
+    printf("%-22s %9.1f MB\n", "  anon huge pages", kb / 1024.0);
+    fflush(stdout);
+}
+
+static void run_lookup(void) {
+    static uint64_t *table[TABLES];
+    size_t slots = TABLE_SIZE / sizeof(uint64_t);
+    for (int t = 0; t < TABLES; t++) {
+        table[t] = malloc(TABLE_SIZE);
+        for (size_t i = 0; i < slots; i++)
+            table[t][i] = next_rand();
+    }
+    bench_hist_t hist;
+    memset(&hist, 0, sizeof(hist));
+    uint64_t v = 0, start = bench_now();
+    for (int b = 0; b < LOOKUPS / BATCH; b++) {
+        uint64_t t0 = bench_now();
+        for (int i = 0; i < BATCH; i++)
+            v = table[v % TABLES][(v >> 8) % slots] + i;
+        bench_hist_add(&hist, (bench_now() - t0) / BATCH);
+    }
+    uint64_t ns = bench_now() - start;
+    if (v == 42)
+        puts("");
+    bench_report("hugepage/lookup", LOOKUPS / BATCH * BATCH, ns, &hist);
+    report_huge();
+    for (int t = 0; t < TABLES; t++)
+        free(table[t]);
+}
+
+static void run_grow(void) {
+    bench_hist_t hist;
+    memset(&hist, 0, sizeof(hist));
+    char *buf = NULL;
+    uint64_t start = bench_now();
+    for (size_t n = GROW_STEP; n <= GROW_MAX; n += GROW_STEP) {
+        uint64_t t0 = bench_now();
+        buf = realloc(buf, n);
+        bench_hist_add(&hist, bench_now() - t0);
+        memset(buf + n - GROW_STEP, (int)(n >> 20), GROW_STEP);
+    }
+    uint64_t ns = bench_now() - start;
+    for (size_t n = GROW_STEP; n <= GROW_MAX; n += GROW_STEP)
+        if (buf[n - 1] != (char)(n >> 20)) {
+            fprintf(stderr, "hugepage/grow: data lost at %zu\n", n);
+            exit(1);
+        }
+    printf("%-22s %9.2f us/op  p99 %7llu ns  peak rss %8.1f MB\n", "hugepage/grow",
+           ns / 1e3 / (GROW_MAX / GROW_STEP), (unsigned long long)bench_hist_pct(&hist, 0.99),
+           bench_peak_rss_mb());
+    report_huge();
+    free(buf);
+}
+
+int main(void) {
+    run_lookup();
+    run_grow();
+    return 0;
+}
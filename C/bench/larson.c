@@ -0,0 +1,89 @@
+// Larson 式的多线程混合负载：每个线程在自己的槽位里不断释放一个随机槽位
+// 再分配一个随机大小的块，做完一轮后由新线程接手这些槽位继续，前一个线程
+// 分配的块就由后一个线程释放。线程数从 1 加到 16
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "bench.h"
+
+#define SLOTS 1024
+#define OPS_PER_ROUND 200000
+#define ROUNDS 10
+#define MAX_THREADS 16
+
+typedef struct worker {
+    void *slot[SLOTS];
+    uint64_t rng;
+    int round;
+    bench_hist_t hist;
+} worker_t;
+
+static worker_t workers[MAX_THREADS];
+
+static uint64_t next_rand(uint64_t *rng) {
+    *rng ^= *rng << 13;
+    *rng ^= *rng >> 7;
+    *rng ^= *rng << 17;
+    return *rng;
+}
+
+// 多数 256 字节以内，八分之一到 4K
+static size_t pick_size(uint64_t r) {
+    return 8 + (r >> 16) % ((r >> 8) & 7 ? 256 : 4096);
+}
+
+static void *run(void *arg) {
+    worker_t *w = arg;
+    for (int i = 0; i < OPS_PER_ROUND; i++) {
+        uint64_t r = next_rand(&w->rng);
+        unsigned k = r % SLOTS;
+        uint64_t t0 = i % BENCH_TIME_EVERY == 0 ? bench_now() : 0;
+        free(w->slot[k]);
+        w->slot[k] = malloc(pick_size(r));
+        *(char *)w->slot[k] = 1;
+        if (t0)
+            bench_hist_add(&w->hist, bench_now() - t0);
+    }
+    // 交给下一个线程，自己退出
+    if (++w->round < ROUNDS) {
+        pthread_t next;
+        pthread_create(&next, NULL, run, w);
+        pthread_detach(next);
+    } else {
+        __atomic_store_n(&w->round, -1, __ATOMIC_RELEASE); // 通知主线程
+    }
+    return NULL;
+}
+
+int main(void) {
+    for (int n = 1; n <= MAX_THREADS; n *= 2) {
+        bench_hist_t hist;
+        memset(&hist, 0, sizeof(hist));
+        for (int i = 0; i < n; i++) {
+            worker_t *w = &workers[i];
+            memset(w, 0, sizeof(*w));
+            w->rng = 88172645463325252ULL + i * 7919;
+            for (unsigned k = 0; k < SLOTS; k++)
+                w->slot[k] = malloc(pick_size(next_rand(&w->rng)));
+        }
+        uint64_t start = bench_now();
+        for (int i = 0; i < n; i++) {
+            pthread_t t;
+            pthread_create(&t, NULL, run, &workers[i]);
+            pthread_detach(t);
+        }
+        for (int i = 0; i < n; i++) {
+            while (__atomic_load_n(&workers[i].round, __ATOMIC_ACQUIRE) != -1)
+                sched_yield();
+            bench_hist_merge(&hist, &workers[i].hist);
+        }
+        uint64_t ns = bench_now() - start;
+        for (int i = 0; i < n; i++)
+            for (unsigned k = 0; k < SLOTS; k++)
+                free(workers[i].slot[k]);
+        char name[32];
+        snprintf(name, sizeof(name), "larson/%d-threads", n);
+        bench_report(name, (uint64_t)n * OPS_PER_ROUND * ROUNDS, ns, &hist);
+    }
+    return 0;
+}
@@ -0,0 +1,101 @@
+// 延迟基准：每次操作都计时，报告尾部分位数和最大值而不是吞吐。
+//   mixed      小块为主、混入到 1M 的大块的随机分配/释放
+//   large-bin  同一个 2 的幂区间里留下几千个都差一点不够大的空闲块，
+//              再反复申请这个区间上端的大小，看查找空闲块要多久
+// 用 memalloc 跑时先释放一个 4M 的映射把 mmap 阈值抬上去，1M 以内的块都从堆里分
+#define _DEFAULT_SOURCE
+#include <stdlib.h>
+
+#include "bench.h"
+
+#define SLOTS 4096
+#define WARMUP 1000000
+#define OPS 5000000
+#define HOLES 2000
+#define LARGE_OPS 20000
+
+static uint64_t rng = 88172645463325252ULL;
+static void *volatile sink; // 否则编译器会把成对的 malloc/free 整个删掉
+
+static uint64_t next_rand(void) {
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return rng;
+}
+
+static size_t pick_size(uint64_t r) {
+    switch (r % 20) {
+    case 0:
+        return 65536 + (r >> 8) % (1 << 20);
+    case 1: case 2: case 3: case 4: case 5:
+        return 1024 + (r >> 8) % 65536;
+    default:
+        return 16 + (r >> 8) % 1008;
+    }
+}
+
+static void report(const char *name, const bench_hist_t *h) {
+    printf("%-22s p50 %5llu  p99 %6llu  p99.9 %7llu  p99.99 %8llu  max %9llu ns\n", name,
+           (unsigned long long)bench_hist_pct(h, 0.5), (unsigned long long)bench_hist_pct(h, 0.99),
+           (unsigned long long)bench_hist_pct(h, 0.999), (unsigned long long)bench_hist_pct(h, 0.9999),
+           (unsigned long long)h->max);
+    fflush(stdout);
+}
+
+static void run_mixed(void) {
+    static void *slot[SLOTS];
+    bench_hist_t hist;
+    memset(&hist, 0, sizeof(hist));
+    for (uint64_t i = 0; i < WARMUP + OPS; i++) {
+        uint64_t r = next_rand();
+        unsigned k = r % SLOTS;
+        uint64_t t0 = bench_now();
+        if (slot[k]) {
+            free(slot[k]);
+            slot[k] = NULL;
+        } else {
+            slot[k] = malloc(pick_size(r >> 12));
+        }
+        uint64_t ns = bench_now() - t0;
+        if (slot[k])
+            *(char *)slot[k] = 1;
+        if (i >= WARMUP)
+            bench_hist_add(&hist, ns);
+    }
+    for (unsigned k = 0; k < SLOTS; k++) {
+        free(slot[k]);
+        slot[k] = NULL;
+    }
+    report("latency/mixed", &hist);
+}
+
+static void run_large_bin(void) {
+    static void *hole[HOLES], *pin[HOLES];
+    bench_hist_t hist;
+    memset(&hist, 0, sizeof(hist));
+    // 空闲块落在 [512K, 1M)，中间夹着占用的小块，不会合并
+    for (unsigned i = 0; i < HOLES; i++) {
+        hole[i] = malloc(512 * 1024 + (next_rand() % (256 * 1024)));
+        pin[i] = malloc(32);
+    }
+    for (unsigned i = 0; i < HOLES; i++)
+        free(hole[i]);
+    for (unsigned i = 0; i < LARGE_OPS; i++) {
+        uint64_t t0 = bench_now();
+        sink = malloc(1000 * 1024);
+        free(sink);
+        bench_hist_add(&hist, bench_now() - t0);
+    }
+    for (unsigned i = 0; i < HOLES; i++)
+        free(pin[i]);
+    report("latency/large-bin", &hist);
+}
+
+int main(void) {
+    sink = malloc(4 << 20);
+    free(sink);
+    run_mixed();
+    run_large_bin();
+    return 0;
+}
@@ -0,0 +1,164 @@
+// 定长对象池对比 malloc：48 字节的节点随机分配/释放、建一条长链表遍历后
+// 整条释放、4 个线程互相释放对方的节点。链接 libmemalloc.so，malloc 一侧
+// 用的也是 memalloc
+#define _DEFAULT_SOURCE
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "../memalloc.h"
+#include "bench.h"
+
+#define SLOTS 8192
+#define OPS 20000000
+#define LIST_NODES 1000000
+#define LIST_ROUNDS 10
+#define THREADS 4
+
+typedef struct node {
+    struct node *next;
+    uint64_t key;
+    char payload[32];
+} node_t;
+
+static memalloc_pool_t *pool;
+
+static void *node_alloc(int use_pool) {
+    return use_pool ? memalloc_pool_alloc(pool) : malloc(sizeof(node_t));
+}
+
+static void node_free(int use_pool, void *node) {
+    if (use_pool)
+        memalloc_pool_free(pool, node);
+    else
+        free(node);
+}
+
+static uint64_t next_rand(uint64_t *rng) {
+    *rng ^= *rng << 13;
+    *rng ^= *rng >> 7;
+    *rng ^= *rng << 17;
+    return *rng;
+}
+
+static void run_churn(int use_pool) {
+    static node_t *slot[SLOTS];
+    uint64_t rng = 88172645463325252ULL;
+    bench_hist_t hist;
+    memset(&hist, 0, sizeof(hist));
+    uint64_t start = bench_now();
+    for (uint64_t i = 0; i < OPS; i++) {
+        unsigned k = next_rand(&rng) % SLOTS;
+        uint64_t t0 = i % BENCH_TIME_EVERY == 0 ? bench_now() : 0;
+        if (slot[k]) {
+            node_free(use_pool, slot[k]);
+            slot[k] = NULL;
+        } else {
+            slot[k] = node_alloc(use_pool);
+            slot[k]->key = i;
+        }
+        if (t0)
+            bench_hist_add(&hist, bench_now() - t0);
+    }
+    uint64_t ns = bench_now() - start;
+    for (unsigned k = 0; k < SLOTS; k++) {
+        node_free(use_pool, slot[k]);
+        slot[k] = NULL;
+    }
+    bench_report(use_pool ? "pool/churn-pool" : "pool/churn-malloc", OPS, ns, &hist);
+}
+
+// 建链表时穿插一些别的分配，malloc 的节点就不再连续，遍历时缓存命中变差。
+// 直方图记的是遍历时平均每个节点的耗时
+static void run_list(int use_pool) {
+    static void *noise[LIST_NODES / 4];
+    bench_hist_t hist;
+    memset(&hist, 0, sizeof(hist));
+    uint64_t start = bench_now(), sum = 0;
+    for (int round = 0; round < LIST_ROUNDS; round++) {
+        node_t *head = NULL;
+        for (unsigned i = 0; i < LIST_NODES; i++) {
+            node_t *n = node_alloc(use_pool);
+            n->key = i;
+            n->next = head;
+            head = n;
+            if (i % 4 == 0)
+                noise[i / 4] = malloc(16 + i % 200);
+        }
+        for (unsigned i = 0; i < LIST_NODES / 4; i++)
+            free(noise[i]);
+        uint64_t t0 = bench_now();
+        for (int pass = 0; pass < 4; pass++)
+            for (node_t *n = head; n; n = n->next)
+                sum += n->key;
+        bench_hist_add(&hist, (bench_now() - t0) / (4 * LIST_NODES));
+        while (head) {
+            node_t *next = head->next;
+            node_free(use_pool, head);
+            head = next;
+        }
+    }
+    if (sum == 42)
+        puts("");
+    bench_report(use_pool ? "pool/list-pool" : "pool/list-malloc", (uint64_t)LIST_ROUNDS * LIST_NODES,
+                 bench_now() - start, &hist);
+}
+
+// 每个线程分配节点放进共享槽位，顺手释放槽位里原来的节点，多半是别的线程分配的
+static void *_Atomic shared[SLOTS];
+static bench_hist_t thread_hist[THREADS];
+static int thread_use_pool;
+
+static void *run_thread(void *arg) {
+    uintptr_t id = (uintptr_t)arg;
+    uint64_t rng = 88172645463325252ULL + id * 7919;
+    for (uint64_t i = 0; i < OPS / THREADS; i++) {
+        unsigned k = next_rand(&rng) % SLOTS;
+        uint64_t t0 = i % BENCH_TIME_EVERY == 0 ? bench_now() : 0;
+        node_t *n = node_alloc(thread_use_pool);
+        n->key = i;
+        void *old = __atomic_exchange_n(&shared[k], n, __ATOMIC_ACQ_REL);
+        if (old)
+            node_free(thread_use_pool, old);
+        if (t0)
+            bench_hist_add(&thread_hist[id], bench_now() - t0);
+    }
+    return NULL;
+}
+
+static void run_threads(int use_pool) {
+    pthread_t threads[THREADS];
+    bench_hist_t hist;
+    memset(&hist, 0, sizeof(hist));
+    memset(thread_hist, 0, sizeof(thread_hist));
+    thread_use_pool = use_pool;
+    uint64_t start = bench_now();
+    for (uintptr_t i = 0; i < THREADS; i++)
+        pthread_create(&threads[i], NULL, run_thread, (void *)i);
+    for (int i = 0; i < THREADS; i++) {
+        pthread_join(threads[i], NULL);
+        bench_hist_merge(&hist, &thread_hist[i]);
+    }
+    uint64_t ns = bench_now() - start;
+    for (unsigned k = 0; k < SLOTS; k++) {
+        node_free(use_pool, shared[k]);
+        shared[k] = NULL;
+    }
+    bench_report(use_pool ? "pool/4-threads-pool" : "pool/4-threads-malloc", OPS / THREADS * THREADS * 2,
+                 ns, &hist);
+}
+
+int main(void) {
+    pool = memalloc_pool_create(sizeof(node_t));
+    for (int use_pool = 0; use_pool <= 1; use_pool++) {
+        run_churn(use_pool);
+        run_list(use_pool);
+        run_threads(use_pool);
+    }
+    memalloc_pool_stats_t st;
+    memalloc_pool_stats(pool, &st);
+    printf("pool stats: object %zu B, %zu slabs, capacity %zu, in use %zu, cached %zu, "
+           "allocs %zu, frees %zu\n",
+           st.object_size, st.slabs, st.capacity, st.in_use, st.cached, st.allocs, st.frees);
+    memalloc_pool_destroy(pool);
+    return 0;
+}
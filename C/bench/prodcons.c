@@ -0,0 +1,87 @@
+// 生产者/消费者基准：生产者分配对象经环形队列交给消费者释放，所有释放都
+// 跨线程。线程对数从 1 加到 8；峰值 rss 用来确认跨线程释放的内存能被重用
+// 而不是越积越多
+#define _DEFAULT_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+
+#include "bench.h"
+
+#define RING 1024 // 2 的幂
+#define ITEMS_PER_PAIR 4000000
+#define MAX_PAIRS 8
+
+// 单生产者单消费者的环形队列，两端各记一份 malloc/free 的延迟
+struct ring {
+    void *slot[RING];
+    _Alignas(64) atomic_size_t head; // 生产者写
+    bench_hist_t alloc_hist;
+    _Alignas(64) atomic_size_t tail; // 消费者写
+    bench_hist_t free_hist;
+};
+
+static struct ring rings[MAX_PAIRS];
+
+static void *producer(void *arg) {
+    struct ring *r = arg;
+    uint64_t rng = 88172645463325252ULL + (uintptr_t)arg;
+    for (size_t i = 0; i < ITEMS_PER_PAIR; i++) {
+        rng ^= rng << 13;
+        rng ^= rng >> 7;
+        rng ^= rng << 17;
+        size_t n = 16 + rng % 240;
+        uint64_t t0 = i % BENCH_TIME_EVERY == 0 ? bench_now() : 0;
+        char *p = malloc(n);
+        if (t0)
+            bench_hist_add(&r->alloc_hist, bench_now() - t0);
+        memset(p, (int)i, n);
+        size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+        while (head - atomic_load_explicit(&r->tail, memory_order_acquire) == RING)
+            sched_yield();
+        r->slot[head % RING] = p;
+        atomic_store_explicit(&r->head, head + 1, memory_order_release);
+    }
+    return NULL;
+}
+
+static void *consumer(void *arg) {
+    struct ring *r = arg;
+    for (size_t i = 0; i < ITEMS_PER_PAIR; i++) {
+        size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+        while (atomic_load_explicit(&r->head, memory_order_acquire) == tail)
+            sched_yield();
+        uint64_t t0 = i % BENCH_TIME_EVERY == 0 ? bench_now() : 0;
+        free(r->slot[tail % RING]);
+        if (t0)
+            bench_hist_add(&r->free_hist, bench_now() - t0);
+        atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+    }
+    return NULL;
+}
+
+int main(void) {
+    pthread_t threads[2 * MAX_PAIRS];
+    for (int n = 1; n <= MAX_PAIRS; n *= 2) {
+        bench_hist_t hist;
+        memset(&hist, 0, sizeof(hist));
+        memset(rings, 0, sizeof(rings));
+        uint64_t start = bench_now();
+        for (int i = 0; i < n; i++) {
+            pthread_create(&threads[2 * i], NULL, producer, &rings[i]);
+            pthread_create(&threads[2 * i + 1], NULL, consumer, &rings[i]);
+        }
+        for (int i = 0; i < 2 * n; i++)
+            pthread_join(threads[i], NULL);
+        uint64_t ns = bench_now() - start;
+        for (int i = 0; i < n; i++) {
+            bench_hist_merge(&hist, &rings[i].alloc_hist);
+            bench_hist_merge(&hist, &rings[i].free_hist);
+        }
+        char name[32];
+        snprintf(name, sizeof(name), "prodcons/%d-pairs", n);
+        bench_report(name, (uint64_t)n * ITEMS_PER_PAIR * 2, ns, &hist);
+    }
+    return 0;
+}
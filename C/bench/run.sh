@@ -0,0 +1,47 @@
+#!/bin/sh
+# 分别用系统分配器和 memalloc 跑一遍所有基准，外加 kilo 和 shell 的端到端运行。
+# 由 make -C C bench 调用，产物都在 build/ 下
+set -e
+cd "$(dirname "$0")/.."
+BUILD=build
+LIB=$PWD/$BUILD/libmemalloc.so
+TLSF=$PWD/$BUILD/libmemalloc-tlsf.so
+
+# kilo 打开的文件和喂给 shell 的脚本
+if [ ! -f $BUILD/e2e.txt ]; then
+    awk 'BEGIN { for (i = 1; i <= 200000; i++) printf "line %d int x = foo(bar, %d); // comment\n", i, i * 7 }' > $BUILD/e2e.txt
+fi
+if [ ! -f $BUILD/e2e.sh ]; then
+    awk 'BEGIN {
+        for (i = 0; i < 20000; i++) print "cd ."
+        for (i = 0; i < 200; i++) { printf "cd ."; for (j = 0; j < 3000; j++) printf " arg%d", j; print "" }
+        for (i = 0; i < 50; i++) print "true"
+        print "exit"
+    }' > $BUILD/e2e.sh
+fi
+
+for bench in sizes larson prodcons grow frag latency calloc hugepage; do
+    echo "== $bench: glibc"
+    $BUILD/$bench
+    echo "== $bench: memalloc"
+    LD_PRELOAD=$LIB $BUILD/$bench
+done
+echo "== latency: memalloc-tlsf"
+LD_PRELOAD=$TLSF $BUILD/latency
+for mode in thp hugetlb; do
+    echo "== hugepage: memalloc MEMALLOC_HUGEPAGE=$mode"
+    MEMALLOC_HUGEPAGE=$mode LD_PRELOAD=$LIB $BUILD/hugepage
+done
+
+# 扩展接口的基准直接链接 memalloc
+for bench in arena pool; do
+    echo "== $bench: memalloc"
+    $BUILD/$bench
+done
+
+echo "== end-to-end: glibc"
+$BUILD/e2e shell $BUILD/e2e.sh $BUILD/shell
+$BUILD/e2e kilo $BUILD/e2e.txt kilo/kilo
+echo "== end-to-end: memalloc"
+LD_PRELOAD=$LIB $BUILD/e2e shell $BUILD/e2e.sh $BUILD/shell
+LD_PRELOAD=$LIB $BUILD/e2e kilo $BUILD/e2e.txt kilo/kilo
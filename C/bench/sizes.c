@@ -0,0 +1,71 @@
+// 单线程吞吐：几种大小分布下随机分配/释放，槽位半满时达到稳态
+#define _DEFAULT_SOURCE
+#include <stdlib.h>
+
+#include "bench.h"
+
+#define SLOTS 8192
+#define OPS 20000000
+
+static uint64_t rng = 88172645463325252ULL;
+
+static uint64_t next_rand(void) {
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return rng;
+}
+
+static size_t size_fixed(uint64_t r) {
+    (void)r;
+    return 64;
+}
+
+static size_t size_small(uint64_t r) {
+    return 16 + r % 497;
+}
+
+// 大致按 1/size 分布，多数很小，偶尔到 64K
+static size_t size_powerlaw(uint64_t r) {
+    return 16 + ((r >> 20) & ((1ULL << (4 + r % 13)) - 1));
+}
+
+static size_t size_large(uint64_t r) {
+    return 65536 + r % (1 << 20);
+}
+
+static void run(const char *name, size_t (*pick)(uint64_t), uint64_t ops) {
+    static void *slot[SLOTS];
+    bench_hist_t hist;
+    memset(&hist, 0, sizeof(hist));
+    uint64_t start = bench_now();
+    for (uint64_t i = 0; i < ops; i++) {
+        uint64_t r = next_rand();
+        unsigned k = r % SLOTS;
+        uint64_t t0 = i % BENCH_TIME_EVERY == 0 ? bench_now() : 0;
+        if (slot[k]) {
+            free(slot[k]);
+            slot[k] = NULL;
+        } else {
+            size_t n = pick(r >> 13);
+            slot[k] = malloc(n);
+            *(char *)slot[k] = 1;
+        }
+        if (t0)
+            bench_hist_add(&hist, bench_now() - t0);
+    }
+    uint64_t ns = bench_now() - start;
+    for (unsigned k = 0; k < SLOTS; k++) {
+        free(slot[k]);
+        slot[k] = NULL;
+    }
+    bench_report(name, ops, ns, &hist);
+}
+
+int main(void) {
+    run("sizes/fixed-64", size_fixed, OPS);
+    run("sizes/16-512", size_small, OPS);
+    run("sizes/powerlaw-64K", size_powerlaw, OPS);
+    run("sizes/64K-1M", size_large, OPS / 20);
+    return 0;
+}
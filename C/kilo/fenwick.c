@@ -0,0 +1,248 @@
+#include "fenwick.h"
+#include <stdlib.h>
+#include <string.h>
+
+static int fenwick_reserve(struct fenwick *f, int nblocks) {
+    if (nblocks + 1 <= f->cap) {
+        return 0;
+    }
+    int cap = f->cap ? f->cap : 64;
+    while (cap < nblocks + 1) {
+        cap *= 2;
+    }
+    struct fenwick_block **blocks = realloc(f->blocks, sizeof(*blocks) * cap);
+    if (blocks == NULL) {
+        return -1;
+    }
+    f->blocks = blocks;
+    long *sums = realloc(f->sums, sizeof(long) * cap);
+    if (sums == NULL) {
+        return -1;
+    }
+    f->sums = sums;
+    long *counts = realloc(f->counts, sizeof(long) * cap);
+    if (counts == NULL) {
+        return -1;
+    }
+    f->counts = counts;
+    f->cap = cap;
+    return 0;
+}
+
+// 树状数组 t[1..n] 的基本操作，i 为从 0 开始的下标
+
+static void tree_add(long *t, int n, int i, long delta) {
+    for (i++; i <= n; i += i & -i) {
+        t[i] += delta;
+    }
+}
+
+// 前 i 项之和
+static long tree_prefix(const long *t, int i) {
+    long sum = 0;
+    for (; i > 0; i -= i & -i) {
+        sum += t[i];
+    }
+    return sum;
+}
+
+// 各项非负时，返回前缀和首次超过 k 的下标，before 为它之前的各项之和；
+// k 不小于总和时返回 n
+static int tree_find(const long *t, int n, long k, long *before) {
+    int pos = 0;
+    long sum = 0;
+    int step = 1;
+    while (step * 2 <= n) {
+        step *= 2;
+    }
+    for (; step > 0; step /= 2) {
+        if (pos + step <= n && sum + t[pos + step] <= k) {
+            pos += step;
+            sum += t[pos];
+        }
+    }
+    *before = sum;
+    return pos;
+}
+
+// 块增删之后由各块的和与元素个数原地重建两棵树，O(块数)
+static void fenwick_build(struct fenwick *f) {
+    for (int b = 0; b < f->nblocks; b++) {
+        f->sums[b + 1] = f->blocks[b]->sum;
+        f->counts[b + 1] = f->blocks[b]->n;
+    }
+    for (int i = 1; i <= f->nblocks; i++) {
+        int parent = i + (i & -i);
+        if (parent <= f->nblocks) {
+            f->sums[parent] += f->sums[i];
+            f->counts[parent] += f->counts[i];
+        }
+    }
+}
+
+// 第 i 个元素所在的块及块内位置；i == n 时为最后一块的末尾
+static struct fenwick_block *fenwick_locate(struct fenwick *f, int i, int *b,
+                                            int *off) {
+    if (i >= f->n) {
+        *b = f->nblocks - 1;
+        *off = f->blocks[*b]->n;
+    } else {
+        long before;
+        *b = tree_find(f->counts, f->nblocks, i, &before);
+        *off = i - (int)before;
+    }
+    return f->blocks[*b];
+}
+
+static void fenwick_free_blocks(struct fenwick *f) {
+    for (int b = 0; b < f->nblocks; b++) {
+        free(f->blocks[b]);
+    }
+    f->nblocks = 0;
+    f->n = 0;
+}
+
+// 调整为 n 个 0，之后用 fenwick_set 写入初始值。各块先只装一半，留出插入的余地
+int fenwick_reset(struct fenwick *f, int n) {
+    fenwick_free_blocks(f);
+    int nblocks = n > 0 ? (n + FENWICK_BLOCK - 1) / FENWICK_BLOCK : 1;
+    if (fenwick_reserve(f, nblocks) == -1) {
+        return -1;
+    }
+    for (int b = 0; b < nblocks; b++) {
+        struct fenwick_block *blk = malloc(sizeof(*blk));
+        if (blk == NULL) {
+            fenwick_free_blocks(f);
+            return -1;
+        }
+        int left = n - b * FENWICK_BLOCK;
+        blk->n = left < FENWICK_BLOCK ? left : FENWICK_BLOCK;
+        blk->sum = 0;
+        memset(blk->vals, 0, sizeof(int) * blk->n);
+        f->blocks[f->nblocks++] = blk;
+    }
+    f->n = n;
+    fenwick_build(f);
+    return 0;
+}
+
+void fenwick_set(struct fenwick *f, int i, int v) {
+    int b, off;
+    struct fenwick_block *blk = fenwick_locate(f, i, &b, &off);
+    fenwick_add(f, i, v - blk->vals[off]);
+}
+
+// 在下标 i 处插入一个元素，其后的元素后移；所在的块满了先分成两半
+int fenwick_insert(struct fenwick *f, int i, int v) {
+    if (f->nblocks == 0 && fenwick_reset(f, 0) == -1) {
+        return -1;
+    }
+    int b, off;
+    struct fenwick_block *blk = fenwick_locate(f, i, &b, &off);
+    if (blk->n == 2 * FENWICK_BLOCK) {
+        struct fenwick_block *next = malloc(sizeof(*next));
+        if (next == NULL || fenwick_reserve(f, f->nblocks + 1) == -1) {
+            free(next);
+            return -1;
+        }
+        next->n = FENWICK_BLOCK;
+        next->sum = 0;
+        memcpy(next->vals, blk->vals + FENWICK_BLOCK, sizeof(int) * FENWICK_BLOCK);
+        for (int j = 0; j < FENWICK_BLOCK; j++) {
+            next->sum += next->vals[j];
+        }
+        blk->n = FENWICK_BLOCK;
+        blk->sum -= next->sum;
+        memmove(&f->blocks[b + 2], &f->blocks[b + 1],
+                sizeof(*f->blocks) * (f->nblocks - b - 1));
+        f->blocks[b + 1] = next;
+        f->nblocks++;
+        fenwick_build(f);
+        if (off > FENWICK_BLOCK) {
+            b++;
+            off -= FENWICK_BLOCK;
+            blk = next;
+        }
+    }
+    memmove(&blk->vals[off + 1], &blk->vals[off], sizeof(int) * (blk->n - off));
+    blk->vals[off] = v;
+    blk->n++;
+    blk->sum += v;
+    f->n++;
+    tree_add(f->counts, f->nblocks, b, 1);
+    tree_add(f->sums, f->nblocks, b, v);
+    return 0;
+}
+
+// 删掉下标 i 处的元素；块删空时去掉这一块（至少保留一块）
+void fenwick_delete(struct fenwick *f, int i) {
+    int b, off;
+    struct fenwick_block *blk = fenwick_locate(f, i, &b, &off);
+    int v = blk->vals[off];
+    memmove(&blk->vals[off], &blk->vals[off + 1], sizeof(int) * (blk->n - off - 1));
+    blk->n--;
+    blk->sum -= v;
+    f->n--;
+    if (blk->n == 0 && f->nblocks > 1) {
+        free(blk);
+        memmove(&f->blocks[b], &f->blocks[b + 1],
+                sizeof(*f->blocks) * (f->nblocks - b - 1));
+        f->nblocks--;
+        fenwick_build(f);
+        return;
+    }
+    tree_add(f->counts, f->nblocks, b, -1);
+    tree_add(f->sums, f->nblocks, b, -v);
+}
+
+void fenwick_add(struct fenwick *f, int i, int delta) {
+    int b, off;
+    struct fenwick_block *blk = fenwick_locate(f, i, &b, &off);
+    blk->vals[off] += delta;
+    blk->sum += delta;
+    tree_add(f->sums, f->nblocks, b, delta);
+}
+
+// 前 i 个元素之和
+long fenwick_prefix(struct fenwick *f, int i) {
+    if (f->nblocks == 0) {
+        return 0;
+    }
+    int b, off;
+    struct fenwick_block *blk = fenwick_locate(f, i, &b, &off);
+    long sum = tree_prefix(f->sums, b);
+    for (int j = 0; j < off; j++) {
+        sum += blk->vals[j];
+    }
+    return sum;
+}
+
+// 元素非负时，返回前缀和首次超过 k 的下标，before 为它之前的元素之和；
+// k 不小于总和时返回 n
+int fenwick_find(struct fenwick *f, long k, long *before) {
+    long sum;
+    int b = tree_find(f->sums, f->nblocks, k, &sum);
+    if (b == f->nblocks) {
+        *before = sum;
+        return f->n;
+    }
+    int i = (int)tree_prefix(f->counts, b);
+    struct fenwick_block *blk = f->blocks[b];
+    int j = 0;
+    while (sum + blk->vals[j] <= k) {
+        sum += blk->vals[j++];
+    }
+    *before = sum;
+    return i + j;
+}
+
+void fenwick_free(struct fenwick *f) {
+    fenwick_free_blocks(f);
+    free(f->blocks);
+    free(f->sums);
+    free(f->counts);
+    f->blocks = NULL;
+    f->sums = NULL;
+    f->counts = NULL;
+    f->cap = 0;
+}
@@ -0,0 +1,44 @@
+#ifndef FENWICK_H
+#define FENWICK_H
+
+// 分块的树状数组：元素按顺序存在若干块里，每块不超过 2 * FENWICK_BLOCK 个，
+// 块的元素和与元素个数各用一棵树状数组维护。单点修改、中间插入/删除元素、
+// 前缀和与按前缀和查找都是 O(FENWICK_BLOCK + log n)；只有块分裂或删空时
+// 才花 O(n / FENWICK_BLOCK) 重建两棵树
+#define FENWICK_BLOCK 256
+
+struct fenwick_block {
+    int n;
+    long sum;
+    int vals[2 * FENWICK_BLOCK];
+};
+
+struct fenwick {
+    struct fenwick_block **blocks;
+    long *sums;   // sums[1..nblocks]，块的元素和
+    long *counts; // counts[1..nblocks]，块的元素个数
+    int nblocks;
+    int cap;   // blocks/sums/counts 的容量
+    int n;     // 元素总数
+};
+
+#define FENWICK_INIT                                                           \
+    { NULL, NULL, NULL, 0, 0, 0 }
+
+int fenwick_reset(struct fenwick *f, int n);
+
+void fenwick_set(struct fenwick *f, int i, int v);
+
+int fenwick_insert(struct fenwick *f, int i, int v);
+
+void fenwick_delete(struct fenwick *f, int i);
+
+void fenwick_add(struct fenwick *f, int i, int delta);
+
+long fenwick_prefix(struct fenwick *f, int i);
+
+int fenwick_find(struct fenwick *f, long k, long *before);
+
+void fenwick_free(struct fenwick *f);
+
+#endif
@@ -0,0 +1,132 @@
+// 读取 keywords.txt，为每张关键字表搜索一个无冲突的哈希种子，输出 keywords.h
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "kwhash.h"
+
+#define GEN_MAX_TABLES 32
+#define GEN_MAX_WORDS 512
+#define GEN_SEED_TRIES (1 << 16)
+
+struct gen_table {
+    char name[32];
+    int n;
+    char *words[GEN_MAX_WORDS];
+    int types[GEN_MAX_WORDS];
+};
+
+struct gen_table tables[GEN_MAX_TABLES];
+int ntables = 0;
+
+struct gen_table *gen_find_table(const char *name) {
+    for (int j = 0; j < ntables; j++) {
+        if (strcmp(tables[j].name, name) == 0) {
+            return &tables[j];
+        }
+    }
+    if (ntables == GEN_MAX_TABLES) {
+        fprintf(stderr, "gen_keywords: too many tables\n");
+        exit(EXIT_FAILURE);
+    }
+    struct gen_table *t = &tables[ntables++];
+    snprintf(t->name, sizeof(t->name), "%s", name);
+    return t;
+}
+
+// 在 size 个槽中为 t 找一个无冲突的种子，找不到返回 -1
+long gen_find_seed(struct gen_table *t, unsigned size) {
+    char *used = malloc(size);
+    for (unsigned seed = 0; seed < GEN_SEED_TRIES; seed++) {
+        memset(used, 0, size);
+        int j;
+        for (j = 0; j < t->n; j++) {
+            unsigned slot =
+                kw_hash(seed, t->words[j], strlen(t->words[j])) & (size - 1);
+            if (used[slot])
+                break;
+            used[slot] = 1;
+        }
+        if (j == t->n) {
+            free(used);
+            return seed;
+        }
+    }
+    free(used);
+    return -1;
+}
+
+void gen_emit(struct gen_table *t) {
+    unsigned size = 1;
+    while (size < (unsigned)t->n * 2) {
+        size <<= 1;
+    }
+    long seed;
+    while ((seed = gen_find_seed(t, size)) == -1) {
+        size <<= 1;
+    }
+
+    int min_len = 255, max_len = 0;
+    printf("static const struct kwentry kw_%s_slots[%u] = {\n", t->name, size);
+    for (int j = 0; j < t->n; j++) {
+        int len = strlen(t->words[j]);
+        unsigned slot = kw_hash(seed, t->words[j], len) & (size - 1);
+        printf("    [%u] = {\"%s\", %d, %d},\n", slot, t->words[j], len,
+               t->types[j]);
+        if (len < min_len)
+            min_len = len;
+        if (len > max_len)
+            max_len = len;
+    }
+    printf("};\n");
+    printf("static const struct kwtable kw_%s = {kw_%s_slots, %uu, %ldu, %d, "
+           "%d};\n\n",
+           t->name, t->name, size - 1, seed, min_len, max_len);
+}
+
+int main(int argc, char const *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: gen_keywords <keywords.txt>\n");
+        return EXIT_FAILURE;
+    }
+    FILE *fp = fopen(argv[1], "r");
+    if (fp == NULL) {
+        perror("gen_keywords");
+        return EXIT_FAILURE;
+    }
+
+    char *line = NULL;
+    size_t line_cap = 0;
+    while (getline(&line, &line_cap, fp) != -1) {
+        char *tok = strtok(line, " \t\r\n");
+        if (tok == NULL || tok[0] == '#')
+            continue;
+        struct gen_table *t = gen_find_table(tok);
+        while ((tok = strtok(NULL, " \t\r\n")) != NULL) {
+            int len = strlen(tok);
+            int type = 1;
+            if (tok[len - 1] == '|') {
+                tok[--len] = '\0';
+                type = 2;
+            }
+            if (t->n == GEN_MAX_WORDS || len == 0 || len > 255) {
+                fprintf(stderr, "gen_keywords: bad keyword in %s\n", t->name);
+                return EXIT_FAILURE;
+            }
+            t->words[t->n] = strdup(tok);
+            t->types[t->n] = type;
+            t->n++;
+        }
+    }
+    free(line);
+    fclose(fp);
+
+    printf("// 由 gen_keywords 根据 keywords.txt 生成，请勿手动修改\n");
+    printf("#ifndef KEYWORDS_H\n#define KEYWORDS_H\n\n#include \"kwhash.h\"\n\n");
+    for (int j = 0; j < ntables; j++) {
+        gen_emit(&tables[j]);
+    }
+    printf("#endif\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,88 @@
+#define _DEFAULT_SOURCE
+#include "gzio.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#define GZIO_CHUNK (1024 * 1024)
+
+static char gzio_errmsg[128];
+
+// 文件以 gzip 魔数 1f 8b 开头
+int gzio_detect(int fd) {
+    unsigned char magic[2];
+    return pread(fd, magic, 2, 0) == 2 && magic[0] == 0x1f && magic[1] == 0x8b;
+}
+
+// 把整个文件解压到新分配的内存，内存不足时返回 NULL；fd 仍由调用者关闭。
+// 压缩数据损坏或被截断时返回已解压的部分，*err 指向错误信息，否则为 NULL
+char *gzio_read(int fd, size_t *len, const char **err) {
+    *err = NULL;
+    int dup_fd = dup(fd);
+    if (dup_fd == -1) {
+        return NULL;
+    }
+    gzFile gz = gzdopen(dup_fd, "rb");
+    if (gz == NULL) {
+        close(dup_fd);
+        return NULL;
+    }
+    gzbuffer(gz, GZIO_CHUNK);
+    size_t cap = GZIO_CHUNK, n = 0;
+    char *buf = malloc(cap);
+    while (buf != NULL) {
+        if (n == cap) {
+            char *grown = realloc(buf, cap * 2);
+            if (grown == NULL) {
+                free(buf);
+                buf = NULL;
+                break;
+            }
+            buf = grown;
+            cap *= 2;
+        }
+        int got = gzread(gz, buf + n, cap - n < GZIO_CHUNK ? cap - n : GZIO_CHUNK);
+        // 数据被截断时 zlib 先交出已解压的部分，错误只记在状态里
+        int errnum;
+        const char *msg = gzerror(gz, &errnum);
+        if (got < 0 || errnum != Z_OK) {
+            snprintf(gzio_errmsg, sizeof(gzio_errmsg), "%s", msg);
+            *err = gzio_errmsg;
+            if (got > 0) {
+                n += got;
+            }
+            break;
+        }
+        if (got == 0) {
+            break;
+        }
+        n += got;
+    }
+    gzclose(gz);
+    *len = n;
+    return buf;
+}
+
+// 压缩后写入 fd（从当前位置开始），fd 仍由调用者关闭
+int gzio_write(int fd, const char *buf, size_t len) {
+    int dup_fd = dup(fd);
+    if (dup_fd == -1) {
+        return -1;
+    }
+    gzFile gz = gzdopen(dup_fd, "wb");
+    if (gz == NULL) {
+        close(dup_fd);
+        return -1;
+    }
+    while (len > 0) {
+        unsigned n = len < GZIO_CHUNK ? len : GZIO_CHUNK;
+        if (gzwrite(gz, buf, n) != (int)n) {
+            gzclose(gz);
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return gzclose(gz) == Z_OK ? 0 : -1;
+}
@@ -0,0 +1,14 @@
+#ifndef GZIO_H
+#define GZIO_H
+
+#include <stddef.h>
+
+// gzip 压缩文件的整体读写；流式解压在 loader 线程里做
+
+int gzio_detect(int fd);
+
+char *gzio_read(int fd, size_t *len, const char **err);
+
+int gzio_write(int fd, const char *buf, size_t len);
+
+#endif
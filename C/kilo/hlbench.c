@@ -0,0 +1,85 @@
+// 语法高亮吞吐基准：对每种语言的样例文本反复高亮，低于目标 MB/s 时返回非零
+#define _POSIX_C_SOURCE 199309L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "syntax.h"
+
+#define HLBENCH_BYTES (32 * 1024 * 1024)
+#define HLBENCH_TARGET_MBPS 100.0
+
+struct sample {
+    const char *filename;
+    const char *lines[8];
+};
+
+struct sample samples[] = {
+    {"bench.c",
+     {"static int editor_read_key(void) { /* read one key */",
+      "    while ((nread = read(STDIN_FILENO, &c, 1)) != 1) {",
+      "        if (nread == -1 && errno != EAGAIN) return -1; // retry",
+      "    char *s = \"escaped \\\" string\"; unsigned long x = 0x1f;",
+      "    for (int i = 0; i < 128; i++) total += buf[i] * 3.14;", NULL}},
+    {"bench.py",
+     {"def parse(line, sep=','):  # split a record",
+      "    return [int(x) for x in line.split(sep) if x is not None]",
+      "class Loader(object):", "    def __init__(self): self.rows = {'a': 1.5}",
+      NULL}},
+    {"bench.go",
+     {"func (e *Editor) Open(path string) error {",
+      "\tfor i, line := range lines { e.rows = append(e.rows, line) }",
+      "\treturn fmt.Errorf(`raw %d`, 42) /* done */", NULL}},
+    {"bench.json",
+     {"{\"id\": 12345, \"name\": \"kilo\", \"tags\": [\"a\", \"b\"], "
+      "\"ok\": true, \"ratio\": 0.75, \"next\": null}",
+      NULL}},
+    {"bench.yaml",
+     {"server:", "  port: 8080  # listen", "  debug: false",
+      "  name: \"kilo\"", NULL}},
+    {"bench.sh",
+     {"for f in *.log; do", "  if [ -s \"$f\" ]; then echo \"$f\" | gzip; fi",
+      "done  # rotate", NULL}},
+};
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char const *argv[]) {
+    double target = argc > 1 ? atof(argv[1]) : HLBENCH_TARGET_MBPS;
+    int failed = 0;
+    unsigned char hl[4096];
+
+    for (size_t s = 0; s < sizeof(samples) / sizeof(samples[0]); s++) {
+        EditorSyntax *syn = syntax_select(samples[s].filename);
+        if (syn == NULL) {
+            fprintf(stderr, "no syntax for %s\n", samples[s].filename);
+            return EXIT_FAILURE;
+        }
+
+        size_t bytes = 0;
+        double start = now();
+        HlState st = HL_STATE_INIT;
+        while (bytes < HLBENCH_BYTES) {
+            for (int j = 0; samples[s].lines[j]; j++) {
+                const char *line = samples[s].lines[j];
+                int len = strlen(line);
+                HlState row = HL_STATE_INIT;
+                row.in_comment = st.in_comment;
+                syntax_highlight(syn, line, hl, len, &row);
+                st = row;
+                bytes += len;
+            }
+        }
+        double mbps = bytes / (now() - start) / (1024 * 1024);
+        int ok = mbps >= target;
+        failed |= !ok;
+        printf("%-8s %8.1f MB/s %s\n", syn->filetype, mbps, ok ? "" : "(below target)");
+    }
+    printf("target: %.1f MB/s\n", target);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,114 @@
+#include "hlworker.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+static pthread_mutex_t hl_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t hl_cond = PTHREAD_COND_INITIALIZER;
+static struct hl_job *hl_pending = NULL; // 等待 worker 处理
+static struct hl_job *hl_done = NULL;    // 等待 UI 线程取走
+static int hl_running = 0;
+static int hl_pipe[2] = {-1, -1};
+
+static void *hlworker_main(void *arg) {
+    (void)arg;
+    while (1) {
+        pthread_mutex_lock(&hl_lock);
+        while (hl_pending == NULL) {
+            pthread_cond_wait(&hl_cond, &hl_lock);
+        }
+        struct hl_job *job = hl_pending;
+        pthread_mutex_unlock(&hl_lock);
+
+        HlState st = job->begin;
+        for (int j = 0; j < job->count; j++) {
+            struct hl_item *item = &job->items[j];
+            // chunk 之间状态完整延续，行之间只延续多行注释
+            HlState row = HL_STATE_INIT;
+            if (job->chunk >= 0) {
+                row = st;
+            } else {
+                row.in_comment = st.in_comment;
+            }
+            item->hl = malloc(item->rsize ? item->rsize : 1);
+            if (item->hl == NULL) {
+                // 丢掉这一行及之后的结果，它们仍是脏的，下次调度时重新提交
+                for (int k = j; k < job->count; k++) {
+                    free(job->items[k].render);
+                }
+                job->count = j;
+                break;
+            }
+            syntax_highlight(job->syntax, item->render, item->hl, item->rsize,
+                             &row);
+            item->end = row;
+            st = row;
+        }
+
+        pthread_mutex_lock(&hl_lock);
+        hl_pending = NULL;
+        hl_done = job;
+        pthread_mutex_unlock(&hl_lock);
+        write(hl_pipe[1], "", 1);
+    }
+    return NULL;
+}
+
+// 启动 worker，返回供 poll 的通知 fd，失败返回 -1
+int hlworker_start(void) {
+    if (hl_running) {
+        return hl_pipe[0];
+    }
+    if (pipe(hl_pipe) == -1) {
+        return -1;
+    }
+    fcntl(hl_pipe[0], F_SETFL, O_NONBLOCK);
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, hlworker_main, NULL) != 0) {
+        return -1;
+    }
+    pthread_detach(tid);
+    hl_running = 1;
+    return hl_pipe[0];
+}
+
+// 同一时间只有一个任务在途（含尚未取走的结果）
+int hlworker_busy(void) {
+    pthread_mutex_lock(&hl_lock);
+    int busy = hl_pending != NULL || hl_done != NULL;
+    pthread_mutex_unlock(&hl_lock);
+    return busy;
+}
+
+int hlworker_submit(struct hl_job *job) {
+    pthread_mutex_lock(&hl_lock);
+    if (hl_pending != NULL || hl_done != NULL) {
+        pthread_mutex_unlock(&hl_lock);
+        return -1;
+    }
+    hl_pending = job;
+    pthread_cond_signal(&hl_cond);
+    pthread_mutex_unlock(&hl_lock);
+    return 0;
+}
+
+struct hl_job *hlworker_take(void) {
+    char buf[16];
+    while (read(hl_pipe[0], buf, sizeof(buf)) > 0)
+        ;
+    pthread_mutex_lock(&hl_lock);
+    struct hl_job *job = hl_done;
+    hl_done = NULL;
+    pthread_mutex_unlock(&hl_lock);
+    return job;
+}
+
+void hl_job_free(struct hl_job *job) {
+    for (int j = 0; j < job->count; j++) {
+        free(job->items[j].render);
+        free(job->items[j].hl);
+    }
+    free(job->items);
+    free(job);
+}
@@ -0,0 +1,36 @@
+#ifndef HLWORKER_H
+#define HLWORKER_H
+
+#include "syntax.h"
+
+// 后台高亮：UI 线程提交若干连续行（或一个超长行里若干连续 chunk）的 render
+// 快照，worker 计算 hl 后通过管道通知
+
+struct hl_item {
+    unsigned epoch; // 快照时行（或 chunk）的编辑版本号
+    int rsize;
+    char *render;
+    unsigned char *hl; // 结果
+    HlState end;       // 结果：出口状态，按行高亮时只用 in_comment
+};
+
+struct hl_job {
+    const EditorSyntax *syntax;
+    int start;     // 首行下标
+    int chunk;     // >= 0 时各 item 是第 start 行从第 chunk 个起的连续 chunk
+    HlState begin; // 入口状态，按行高亮时只用 in_comment
+    int count;
+    struct hl_item *items;
+};
+
+int hlworker_start(void);
+
+int hlworker_busy(void);
+
+int hlworker_submit(struct hl_job *job);
+
+struct hl_job *hlworker_take(void);
+
+void hl_job_free(struct hl_job *job);
+
+#endif
@@ -5,16 +5,29 @@
 #include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <malloc.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <poll.h>
+#include <signal.h>
 #include <sys/ioctl.h>
+#include <sys/stat.h>
 #include <termios.h>
 #include <time.h>
 #include <unistd.h>
 
 #include "abuf.h"
+#include "fenwick.h"
+#include "gzio.h"
+#include "hlworker.h"
+#include "lineidx.h"
+#include "loader.h"
+#include "syntax.h"
+#include "utf8.h"
+#include "watch.h"
 
 #define CTRL_KEY(k)                                                            \
     ((k)&0x1f) // ascii 前 32 个字符为控制值，即将前三位设为0的所有 ascii 码
@@ -22,6 +35,12 @@
 #define KILO_VERSION "0.0.1"
 #define KILO_TAB_STOP 8
 #define KILO_QUIT_TIMES 3
+#define KILO_LONG_ROW (64 * 1024) // 超过该长度的行按 chunk 存储
+#define KILO_CHUNK_SIZE (16 * 1024)
+#define KILO_HL_BATCH_ROWS 4096 // 每个后台高亮任务的行数与字节数上限
+#define KILO_HL_BATCH_BYTES (256 * 1024)
+#define KILO_STREAM_MIN (8 * 1024 * 1024) // 超过该大小的文件在后台流式加载
+#define KILO_MEM_BUDGET 512 // 所有 buffer 共用的内存预算（MB），可用环境变量覆盖
 
 #define debug(...) write_log("DEBUG", NULL, __VA_ARGS__, NULL)
 #define info(...) write("INFO", NULL, __VA_ARGS__, NULL)
@@ -102,65 +121,110 @@ enum EditorKey {
     PAGE_DOWN,
 };
 
-enum EditorHighlight {
-    HL_NORMAL = 0,
-    HL_COMMENT,
-    HL_STRING,
-    HL_NUMBER,
-    HL_MATCH,
-};
-
-#define HL_HIGHLIGHT_NUMBERS (1<<0)
-#define HL_HIGHLIGHT_STRINGS (1<<1)
-
-typedef struct _editorSyntax
-{
-    char * filetype;
-    char **file_match;
-    int flags;
-} EditorSyntax;
+// 超长行（压缩过的 json / 单行日志）拆成若干 chunk 存储，
+// 每个 chunk 自带 render/hl 缓存，编辑只影响所在 chunk
+typedef struct _echunk {
+    int size;
+    char *chars;
+    int tabs;
+    int ascii;  // chars 全是 ASCII，render 下标即显示列
+    int rstart; // chunk 首字符在整行 render 中的下标
+    int cstart; // chunk 首字符在整行中的显示列
+    int rsize;
+    int cols;
+    char *render;
+    unsigned char *hl;
+    unsigned epoch;    // 每次 render 变化都换一个新的版本号
+    unsigned hl_epoch; // hl 对应的版本号
+    HlState hl_begin; // 高亮本 chunk 时的入口状态
+    HlState hl_end;
+} Echunk;
 
 typedef struct _erow {
     int size;
     char *chars;
     int rsize;
+    int cols; // render 的显示宽度，多字节字符与 ASCII 行不同
+    int ascii;
     char *render;
     unsigned char * hl;
+    unsigned epoch;    // 每次 render 变化都换一个新的版本号
+    unsigned hl_epoch; // hl 对应的版本号，不等于 epoch 时 hl 是旧的
+    int hl_begin_comment; // 计算 hl 时的入口多行注释状态
+    int hl_open_comment; // 行尾仍处于多行注释中
+    int nchunks;
+    Echunk *chunks; // 非 NULL 时 chars/render/hl 均为 NULL
+    int hl_chunk;   // 此前的 chunk 高亮有效，从这里起等待后台重新高亮
+    int wrap_w;     // 计算 wrap 时的屏幕宽度，0 表示需要重算
+    int nwrap;      // 软换行后占用的屏幕行数
+    int *wrap;      // 每个屏幕行的起始显示列，wrap[0] == 0
 } Erow;
 
 struct EditorConfig {
     int screen_rows, screen_cols;
-    int cursor_x, cursor_y, render_cursor_x;
+    int cursor_x, cursor_y, render_cursor_x; // render_cursor_x 与 coloff 均为显示列
     int rowoff;
     int coloff;
+    int wrap;                // 软换行模式
+    long voff;               // 软换行模式下第一个屏幕行的序号
+    int wrap_cy, wrap_cx;    // 软换行模式下光标的屏幕位置
+    int wrap_stale;          // wrap_lines 需要整体重建
+    int first_dirty;   // 自打开/保存以来第一处修改所在的行，INT_MAX 表示未修改
+    int disk_known;    // disk_st 与 lidx 描述了磁盘上的文件
+    int disk_crlf;     // 文件中有 \r\n 行尾
+    struct stat disk_st;
+    int watch_fd, watch_wd; // inotify
+    int disk_changed;       // 磁盘上的文件被改动过，等待 Ctrl-R 重新加载
+    int follow;             // 追加内容时光标跟到末尾
+    int gzip;               // 磁盘上是 gzip 压缩文件，lidx 描述解压后的内容
+    int evicted;            // 行已被释放，切回来时从磁盘重建
+    int readonly;           // 文件没有完整读入（gzip 数据损坏等），不能保存覆盖原文件
+    unsigned used;          // 最近一次切换到该 buffer 的时刻
+    struct fenwick wrap_lines; // 每行占用的屏幕行数
     int row_num;
+    int row_cap;
     Erow *erow;
+    struct lineidx lidx; // 打开文件时建立的行偏移索引
+    int loading;  // 后台加载中
+    int load_fd;
+    int load_row; // 下一批加载的行插入的位置
+    size_t load_bytes, load_total;
     int dirty;
     char *filename;
     char statusmsg[80];
     time_t statusmsg_time;
     EditorSyntax *syntax;
+    unsigned hl_seq;
+    int hl_dirty_from, hl_dirty_to; // 可能需要重新高亮的行区间
+    int hl_fd; // 后台高亮完成通知，-1 表示退回同步高亮
     struct termios orig_termios;
 };
 
 struct EditorConfig E;
 
-char *C_HL_EXTENSIONS[] = {
-    ".c",
-    ".h",
-    ".cpp",
-    NULL
-};
-
-EditorSyntax HLDB[] = {
-    "c",
-    C_HL_EXTENSIONS,
-    HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS
-};
+// 打开的所有 buffer：当前 buffer 的状态在 E 中，buffers[buffer_cur] 只在切走时写回
+static struct EditorConfig *buffers = NULL;
+static int buffer_num = 0, buffer_cap = 0, buffer_cur = 0;
+static unsigned buffer_tick = 0;
+static size_t mem_budget;
+static int hl_buffer = -1;   // 后台高亮任务所属的 buffer
+static int load_buffer = -1; // 正在流式加载的 buffer，同一时刻只有一个
 
-#define HLDB_ENTRIES (sizeof(HLDB) / sizeof(HLDB[0]))
+static volatile sig_atomic_t winch_pending = 0;
 
 void editor_set_status_message(const char *fmt, ...);
+void editor_refresh_screen(void);
+void editor_hl_schedule(void);
+void editor_hl_apply(struct hl_job *job);
+void editor_load_apply(struct load_batch *batch);
+void editor_handle_resize(void);
+void editor_wrap_update(Erow *row);
+void editor_wrap_update_chunks(Erow *row, int start, int end, int delta);
+void editor_check_disk(void);
+struct EditorConfig *editor_buffer_at(int n);
+void editor_buffer_swap(int n);
+void editor_buffer_trim(void);
+void editor_init_buffer(void);
 char * editor_prompt(char *prompt, void (*callbak)(char *, int));
 
 void die(const char *msg) {
@@ -191,9 +255,93 @@ void enable_raw_mode(void) {
         die("tcsetattr");
 }
 
+// 等待按键期间处理后台事件，stdin 可读时返回
+void editor_wait_input(void) {
+    while (1) {
+        editor_hl_schedule();
+
+        struct pollfd fds[4];
+        int nfds = 0, hl_at = -1, load_at = -1, watch_at = -1;
+        fds[nfds++] = (struct pollfd){STDIN_FILENO, POLLIN, 0};
+        if (E.hl_fd != -1) {
+            hl_at = nfds;
+            fds[nfds++] = (struct pollfd){E.hl_fd, POLLIN, 0};
+        }
+        if (load_buffer != -1) {
+            load_at = nfds;
+            fds[nfds++] =
+                (struct pollfd){editor_buffer_at(load_buffer)->load_fd, POLLIN, 0};
+        }
+        if (E.watch_fd != -1) {
+            watch_at = nfds;
+            fds[nfds++] = (struct pollfd){E.watch_fd, POLLIN, 0};
+        }
+        if (poll(fds, nfds, -1) == -1) {
+            if (errno != EINTR)
+                die("poll");
+            if (winch_pending) {
+                editor_handle_resize();
+                editor_refresh_screen();
+            }
+            continue;
+        }
+        if (fds[0].revents) {
+            return;
+        }
+        if (hl_at != -1 && (fds[hl_at].revents & POLLIN)) {
+            struct hl_job *job = hlworker_take();
+            if (job) {
+                int cur = buffer_cur;
+                int rows = job->chunk >= 0 ? 1 : job->count;
+                int visible = hl_buffer == cur &&
+                              job->start < E.rowoff + E.screen_rows &&
+                              job->start + rows > E.rowoff;
+                editor_buffer_swap(hl_buffer);
+                editor_hl_apply(job);
+                editor_buffer_swap(cur);
+                hl_job_free(job);
+                if (visible)
+                    editor_refresh_screen();
+            }
+        }
+        if (load_at != -1 && (fds[load_at].revents & POLLIN)) {
+            struct load_batch *batch = loader_take();
+            if (batch) {
+                int cur = buffer_cur;
+                editor_buffer_swap(load_buffer);
+                editor_load_apply(batch);
+                editor_buffer_swap(cur);
+                if (load_buffer == -1)
+                    editor_buffer_trim();
+                editor_refresh_screen();
+            }
+        }
+        if (watch_at != -1 && (fds[watch_at].revents & POLLIN)) {
+            int changes = watch_read(E.watch_fd);
+            // 事件不区分来自哪个文件，逐个 buffer 检查
+            int cur = buffer_cur;
+            for (int i = 0; i < buffer_num; i++) {
+                editor_buffer_swap(i);
+                if ((changes & WATCH_GONE) && E.filename != NULL) {
+                    // 文件被替换后原来的 watch 已失效，重新监视路径
+                    E.watch_wd = watch_file(E.watch_fd, E.watch_wd, E.filename);
+                }
+                if (changes & WATCH_CHANGED) {
+                    editor_check_disk();
+                }
+            }
+            editor_buffer_swap(cur);
+            if (changes & WATCH_CHANGED) {
+                editor_refresh_screen();
+            }
+        }
+    }
+}
+
 int editor_read_key(void) {
     int nread;
     char c;
+    editor_wait_input();
     while ((nread = read(STDIN_FILENO, &c, 1) != 1)) {
         if (nread == -1 && errno != EAGAIN)
             die("read");
@@ -311,77 +459,306 @@ int get_window_size(int *rows, int *cols) {
     }
 }
 
-int is_separator(int c) {
-  return isspace(c) || c == '\0' || strchr(",.()+-/\\*=~%<>[];", c) != NULL;
+int editor_row_open_comment_before(Erow *row) {
+    int at = row - E.erow;
+    return at > 0 && E.erow[at - 1].hl_open_comment;
+}
+
+// 第 j 个 chunk 应有的入口状态：前一个 chunk 的出口，首个 chunk 只继承多行注释
+HlState editor_chunk_entry(Erow *row, int j) {
+    if (j > 0) {
+        return row->chunks[j - 1].hl_end;
+    }
+    HlState st = HL_STATE_INIT;
+    st.in_comment = editor_row_open_comment_before(row);
+    return st;
+}
+
+// 在 UI 线程高亮第 j 个 chunk，调用前它之前的 chunk 高亮须有效
+void editor_highlight_chunk(Erow *row, int j) {
+    Echunk *ch = &row->chunks[j];
+    HlState st = editor_chunk_entry(row, j);
+    ch->hl_begin = st;
+    syntax_highlight(E.syntax, ch->render, ch->hl, ch->rsize, &st);
+    ch->hl_end = st;
+    ch->hl_epoch = ch->epoch;
 }
 
-void editor_update_syntax(Erow *row) {
-    row->hl = realloc(row->hl, row->rsize);
-    memset(row->hl, HL_NORMAL, row->rsize);
+void editor_set_open_comment(Erow *row, int open);
 
-    if (E.syntax == NULL)
-    {
+// 从 hl_chunk 起跳过 render 没变、入口状态又与前一个 chunk 出口一致的 chunk：
+// 编辑没有改变 chunk 的出口状态时，重新高亮到这里就停下
+void editor_row_hl_advance(Erow *row) {
+    if (row->hl_chunk > 0 && row->chunks[0].hl_begin.in_comment !=
+                                 editor_row_open_comment_before(row)) {
+        row->hl_chunk = 0;
+    }
+    while (row->hl_chunk < row->nchunks) {
+        Echunk *ch = &row->chunks[row->hl_chunk];
+        HlState st = editor_chunk_entry(row, row->hl_chunk);
+        if (ch->hl_epoch != ch->epoch || !hl_state_equal(&st, &ch->hl_begin)) {
+            return;
+        }
+        row->hl_chunk++;
+    }
+    row->hl_begin_comment = row->chunks[0].hl_begin.in_comment;
+    editor_set_open_comment(row, row->chunks[row->nchunks - 1].hl_end.in_comment);
+}
+
+// 在 UI 线程同步高亮一整行（不重新渲染），返回行尾是否仍在多行注释中
+int editor_highlight_row(Erow *row, int in_comment) {
+    HlState st = HL_STATE_INIT;
+    st.in_comment = in_comment;
+    row->hl_begin_comment = in_comment;
+    row->hl_epoch = row->epoch;
+
+    if (row->chunks) {
+        editor_row_hl_advance(row);
+        while (row->hl_chunk < row->nchunks) {
+            editor_highlight_chunk(row, row->hl_chunk++);
+            editor_row_hl_advance(row);
+        }
+        return row->chunks[row->nchunks - 1].hl_end.in_comment;
+    }
+
+    row->hl = realloc(row->hl, row->rsize + 1);
+    syntax_highlight(E.syntax, row->render, row->hl, row->rsize, &st);
+    return st.in_comment;
+}
+
+int editor_row_hl_clean(Erow *row) {
+    if (row->chunks) {
+        return row->hl_chunk == row->nchunks &&
+               row->chunks[0].hl_begin.in_comment ==
+                   editor_row_open_comment_before(row);
+    }
+    return row->hl_epoch == row->epoch &&
+           row->hl_begin_comment == editor_row_open_comment_before(row);
+}
+
+// 把第 at 行加入待高亮区间
+void editor_hl_mark(int at) {
+    if (at < 0 || at >= E.row_num) {
+        return;
+    }
+    if (E.hl_dirty_from >= E.hl_dirty_to) {
+        E.hl_dirty_from = at;
+        E.hl_dirty_to = at + 1;
         return;
     }
+    if (at < E.hl_dirty_from)
+        E.hl_dirty_from = at;
+    if (at + 1 > E.hl_dirty_to)
+        E.hl_dirty_to = at + 1;
+}
 
+// 记录行尾的多行注释状态，有变化时下一行也需要重新高亮
+void editor_set_open_comment(Erow *row, int open) {
+    if (row->hl_open_comment != open) {
+        row->hl_open_comment = open;
+        editor_hl_mark(row - E.erow + 1);
+    }
+}
 
-    // int prev_sep = 1;
-    int i = 0;
-    int in_string = 0;
-    // for ( i = 0; i < row->rsize; i++)
-    // {
-    //     if (isdigit(row->render[i]))
-    //     {
-    //         row->hl[i] = HL_NUMBER;
-    //     }
-    // }
-    while (i < row->rsize)
-    {
-        char c = row->render[i];
-        unsigned char prev_hl = (i > 0) ? row->hl[i-1] : HL_NORMAL;
+// render 变化后调用：先沿用旧的 hl（新增部分为普通色）立即可画，
+// 真正的高亮交给后台，typing 路径上没有高亮开销
+void editor_update_syntax(Erow *row, int old_rsize) {
+    row->hl = realloc(row->hl, row->rsize + 1);
+    if (row->rsize > old_rsize) {
+        memset(&row->hl[old_rsize], HL_NORMAL, row->rsize - old_rsize);
+    }
+    row->epoch = ++E.hl_seq;
+    editor_hl_mark(row - E.erow);
+}
 
-        if (E.syntax->flags & HL_HIGHLIGHT_NUMBERS)
-        {
-            if (isdigit(c) || (c == '.' && prev_hl == HL_NUMBER))
-            {
-                row->hl[i] = HL_NUMBER;
-                i++;
-                // prev_sep = 0;
-                continue;
-            }
+// 把超长行从 hl_chunk 起的一批 chunk 交给后台，每批不超过 KILO_HL_BATCH_BYTES
+void editor_hl_schedule_chunks(int at) {
+    Erow *row = &E.erow[at];
+    struct hl_job *job = malloc(sizeof(*job));
+    if (job == NULL) {
+        return;
+    }
+    job->syntax = E.syntax;
+    job->start = at;
+    job->chunk = row->hl_chunk;
+    job->begin = editor_chunk_entry(row, row->hl_chunk);
+    job->count = 0;
+    int n = row->nchunks - row->hl_chunk;
+    if (n > KILO_HL_BATCH_BYTES / KILO_CHUNK_SIZE) {
+        n = KILO_HL_BATCH_BYTES / KILO_CHUNK_SIZE;
+    }
+    job->items = malloc(sizeof(struct hl_item) * n);
+    if (job->items == NULL) {
+        free(job);
+        return;
+    }
+
+    for (int j = 0; j < n; j++) {
+        Echunk *ch = &row->chunks[job->chunk + j];
+        char *render = malloc(ch->rsize + 1);
+        if (render == NULL) {
+            break;
         }
+        memcpy(render, ch->render, ch->rsize + 1);
+        struct hl_item *item = &job->items[job->count++];
+        item->epoch = ch->epoch;
+        item->rsize = ch->rsize;
+        item->render = render;
+        item->hl = NULL;
+    }
 
-        if (E.syntax->flags & HL_HIGHLIGHT_STRINGS)
-        {
-            if (in_string) {
-                row->hl[i] = HL_STRING;
-                if (c == '\\' && i + 1 < row->rsize) {
-                    row->hl[i + 1] = HL_STRING;
-                    i += 2;
-                    continue;
-                }
-                if (c == in_string) in_string = 0;
-                i++;
-                continue;
-            } else {
-                if (c == '"' || c == '\'') {
-                in_string = c;
-                row->hl[i] = HL_STRING;
-                i++;
-                continue;
+    if (job->count == 0 || hlworker_submit(job) == -1) {
+        hl_job_free(job);
+        return;
+    }
+    hl_buffer = buffer_cur;
+}
+
+// 从待高亮区间头部取一批连续行的 render 快照交给后台；
+// 超长行单独成批，每次只交一段 chunk
+void editor_hl_schedule(void) {
+    if (E.hl_fd != -1 && hlworker_busy()) {
+        return;
+    }
+
+    while (E.hl_dirty_from < E.hl_dirty_to && E.hl_dirty_from < E.row_num) {
+        Erow *row = &E.erow[E.hl_dirty_from];
+        if (row->chunks) {
+            editor_row_hl_advance(row);
+        }
+        if (!editor_row_hl_clean(row)) {
+            if (E.hl_fd != -1) {
+                break;
             }
-      }
+            int open =
+                editor_highlight_row(row, editor_row_open_comment_before(row));
+            editor_set_open_comment(row, open);
         }
+        E.hl_dirty_from++;
+    }
+    if (E.hl_dirty_from >= E.hl_dirty_to || E.hl_dirty_from >= E.row_num) {
+        E.hl_dirty_from = E.hl_dirty_to = 0;
+        return;
+    }
+    if (E.erow[E.hl_dirty_from].chunks) {
+        editor_hl_schedule_chunks(E.hl_dirty_from);
+        return;
+    }
 
-        // prev_sep = is_separator(c);
-        i++;
+    struct hl_job *job = malloc(sizeof(*job));
+    if (job == NULL) {
+        return;
+    }
+    job->syntax = E.syntax;
+    job->start = E.hl_dirty_from;
+    job->chunk = -1;
+    job->begin = (HlState)HL_STATE_INIT;
+    job->begin.in_comment = editor_row_open_comment_before(&E.erow[job->start]);
+    job->items = malloc(sizeof(struct hl_item) * KILO_HL_BATCH_ROWS);
+    job->count = 0;
+    if (job->items == NULL) {
+        free(job);
+        return;
+    }
+
+    int bytes = 0;
+    for (int at = job->start; at < E.hl_dirty_to && at < E.row_num &&
+                              job->count < KILO_HL_BATCH_ROWS &&
+                              bytes < KILO_HL_BATCH_BYTES;
+         at++) {
+        Erow *row = &E.erow[at];
+        if (row->chunks) {
+            break;
+        }
+        char *render = malloc(row->rsize + 1);
+        if (render == NULL) {
+            break;
+        }
+        memcpy(render, row->render, row->rsize + 1);
+        struct hl_item *item = &job->items[job->count++];
+        item->epoch = row->epoch;
+        item->rsize = row->rsize;
+        item->render = render;
+        item->hl = NULL;
+        bytes += row->rsize;
+    }
+
+    if (job->count == 0 || hlworker_submit(job) == -1) {
+        hl_job_free(job);
+        return;
+    }
+    hl_buffer = buffer_cur;
+}
+
+// 应用超长行一批 chunk 的结果：只接在 hl_chunk 处，chunk 快照之后没再变、
+// 入口状态也一致时才采用；出口状态与后面原有的高亮接上时提前停下
+void editor_hl_apply_chunks(struct hl_job *job) {
+    if (job->start >= E.row_num) {
+        return;
+    }
+    Erow *row = &E.erow[job->start];
+    for (int j = 0; j < job->count; j++) {
+        struct hl_item *item = &job->items[j];
+        int c = job->chunk + j;
+        if (row->chunks == NULL || c != row->hl_chunk || c >= row->nchunks) {
+            break;
+        }
+        Echunk *ch = &row->chunks[c];
+        HlState begin = j == 0 ? job->begin : job->items[j - 1].end;
+        HlState entry = editor_chunk_entry(row, c);
+        if (ch->epoch != item->epoch || !hl_state_equal(&entry, &begin)) {
+            break;
+        }
+        free(ch->hl);
+        ch->hl = item->hl;
+        item->hl = NULL;
+        ch->hl_begin = begin;
+        ch->hl_end = item->end;
+        ch->hl_epoch = ch->epoch;
+        row->hl_chunk = c + 1;
+        editor_row_hl_advance(row);
+    }
+}
+
+// 应用后台结果：只有快照之后该行没有再变、入口状态也一致时才采用
+void editor_hl_apply(struct hl_job *job) {
+    if (job->chunk >= 0) {
+        editor_hl_apply_chunks(job);
+        return;
+    }
+    for (int j = 0; j < job->count; j++) {
+        struct hl_item *item = &job->items[j];
+        int at = job->start + j;
+        int begin = j == 0 ? job->begin.in_comment
+                           : job->items[j - 1].end.in_comment;
+        if (at >= E.row_num) {
+            break;
+        }
+        Erow *row = &E.erow[at];
+        if (row->chunks || row->epoch != item->epoch ||
+            row->rsize != item->rsize ||
+            editor_row_open_comment_before(row) != begin) {
+            break;
+        }
+        free(row->hl);
+        row->hl = item->hl;
+        item->hl = NULL;
+        row->hl_epoch = item->epoch;
+        row->hl_begin_comment = begin;
+        editor_set_open_comment(row, item->end.in_comment);
     }
 }
 
 int editor_syntax_to_color(int hl) {
     switch (hl)
     {
-    case HL_COMMENT: return 36;
+    case HL_COMMENT:
+    case HL_MLCOMMENT:
+        return 36;
+    case HL_KEYWORD1:
+        return 33;
+    case HL_KEYWORD2:
+        return 32;
     case HL_STRING:
         return 35;
     case HL_NUMBER:
@@ -396,314 +773,1764 @@ int editor_syntax_to_color(int hl) {
 }
 
 void editor_select_syntax_highlight(void){
-    E.syntax = NULL;
-    if (E.filename == NULL)
+    E.syntax = syntax_select(E.filename);
+
+    // 所有行换新版本号，由后台自上而下重新高亮
+    for (int filerow = 0; filerow < E.row_num; filerow++)
     {
-        return;
+        E.erow[filerow].epoch = ++E.hl_seq;
+        E.erow[filerow].hl_chunk = 0;
+        for (int j = 0; j < E.erow[filerow].nchunks; j++) {
+            E.erow[filerow].chunks[j].hl_epoch = 0;
+        }
+    }
+    E.hl_dirty_from = 0;
+    E.hl_dirty_to = E.row_num;
+}
+
+int editor_count_tabs(const char *chars, int size) {
+    int tabs = 0;
+    for (int j = 0; j < size; j++) {
+        if (chars[j] == '\t')
+            tabs++;
     }
+    return tabs;
+}
 
-    char *ext = strrchr(E.filename, '.');
+// 从 col 列开始，向后累加 chars 前 n 个字节的显示宽度
+int editor_chars_cx_to_col(const char *chars, int n, int col, int ascii) {
+    int j;
 
-    for (unsigned int j = 0; j < HLDB_ENTRIES; j++)
-    {
-        EditorSyntax *s = &HLDB[j];
-        unsigned int i = 0;
-        while (s->file_match[i])
-        {
-            int is_ext = (s->file_match[i][0] == '.');
-            if (
-                (is_ext && ext && !strcmp(ext, s->file_match[i]))
-                ||
-                (!is_ext && strstr(E.filename, s->file_match[i]))
-            )
-            {
-                E.syntax = s;
-                int filerow;
-                for ( filerow = 0; filerow < E.row_num; filerow++)
-                {
-                    editor_update_syntax(&E.erow[filerow]);
+    if (ascii) {
+        for (j = 0; j < n; j++) {
+            if (chars[j] == '\t') {
+                col += (KILO_TAB_STOP - 1) - (col % KILO_TAB_STOP);
+            }
+            col++;
+        }
+        return col;
+    }
+
+    for (j = 0; j < n;) {
+        if (chars[j] == '\t') {
+            col += KILO_TAB_STOP - (col % KILO_TAB_STOP);
+            j++;
+        } else {
+            unsigned cp;
+            j += utf8_decode(&chars[j], n - j, &cp);
+            col += utf8_char_width(cp);
+        }
+    }
+    return col;
+}
+
+// 从第 col 列开始展开 chars 到 render（tab 按绝对显示列对齐），返回 render
+// 长度，cols 返回显示宽度；ascii 为真时每个字节占一列，走原来的快速路径
+int editor_render_chars(const char *chars, int size, int col, int ascii,
+                        char *render, int *cols) {
+    int idx = 0;
+    if (ascii) {
+        for (int j = 0; j < size; j++) {
+            if (chars[j] == '\t') {
+                render[idx++] = ' ';
+                while ((col + idx) % KILO_TAB_STOP != 0) {
+                    render[idx++] = ' ';
                 }
 
-                return;
+            } else {
+                render[idx++] = chars[j];
             }
-            i++;
         }
-
+        render[idx] = '\0';
+        *cols = idx;
+        return idx;
     }
 
+    int c = col;
+    for (int j = 0; j < size;) {
+        if (chars[j] == '\t') {
+            render[idx++] = ' ';
+            c++;
+            while (c % KILO_TAB_STOP != 0) {
+                render[idx++] = ' ';
+                c++;
+            }
+            j++;
+        } else {
+            unsigned cp;
+            int n = utf8_decode(&chars[j], size - j, &cp);
+            memcpy(&render[idx], &chars[j], n);
+            idx += n;
+            j += n;
+            c += utf8_char_width(cp);
+        }
+    }
 
+    render[idx] = '\0';
+    *cols = c - col;
+    return idx;
 }
 
-int editor_row_cx_to_rx(Erow *row, int cursor_x) {
-    int rx = 0;
+// 返回包含字符偏移 at 的 chunk 下标，off 为该 chunk 的起始偏移；
+// at 恰好落在两个 chunk 之间时归属前一个
+int editor_row_chunk_at(Erow *row, int at, int *off) {
+    int start = 0;
     int j;
+    for (j = 0; j < row->nchunks - 1; j++) {
+        if (at <= start + row->chunks[j].size) {
+            break;
+        }
+        start += row->chunks[j].size;
+    }
+    *off = start;
+    return j;
+}
 
-    for (j = 0; j < cursor_x; j++) {
-        if (row->chars[j] == '\t') {
-            rx += (KILO_TAB_STOP - 1) - (rx % KILO_TAB_STOP);
-            // debug("char: %c, rx: %d", row->chars[j], rx);
+// 二分查找包含 render 列 rx 的 chunk
+int editor_row_chunk_at_rx(Erow *row, int rx) {
+    int lo = 0, hi = row->nchunks - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (row->chunks[mid].rstart <= rx) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
         }
-        // debug("rx: %d", rx);
-        rx++;
     }
-    return rx;
+    return lo;
+}
+
+// 二分查找包含显示列 col 的 chunk
+int editor_row_chunk_at_col(Erow *row, int col) {
+    int lo = 0, hi = row->nchunks - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (row->chunks[mid].cstart <= col) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return lo;
+}
+
+int editor_row_cx_to_col(Erow *row, int cursor_x) {
+    if (row->chunks) {
+        int off;
+        Echunk *ch = &row->chunks[editor_row_chunk_at(row, cursor_x, &off)];
+        return editor_chars_cx_to_col(ch->chars, cursor_x - off, ch->cstart,
+                                      ch->ascii);
+    }
+    return editor_chars_cx_to_col(row->chars, cursor_x, 0, row->ascii);
 }
 
 int editor_row_rx_to_cx(Erow *row, int rx) {
+    const char *chars = row->chars;
+    int size = row->size;
+    int ascii = row->ascii;
     int cur_rx = 0;
+    int col = 0;
+    int off = 0;
     int cx;
-    for ( cx = 0; cx < row->size; cx++)
+
+    if (row->chunks) {
+        int k = editor_row_chunk_at_rx(row, rx);
+        for (int j = 0; j < k; j++) {
+            off += row->chunks[j].size;
+        }
+        chars = row->chunks[k].chars;
+        size = row->chunks[k].size;
+        ascii = row->chunks[k].ascii;
+        cur_rx = row->chunks[k].rstart;
+        col = row->chunks[k].cstart;
+    }
+
+    // rx 是 render 下标：tab 展开的空格数取决于显示列，多字节字符原样占用字节
+    for ( cx = 0; cx < size; )
     {
-        if (row->chars[cx] == '\t')
+        int n = 1;
+        if (chars[cx] == '\t')
         {
-            cur_rx += (KILO_TAB_STOP - 1) - (cur_rx % KILO_TAB_STOP);
+            int w = KILO_TAB_STOP - (col % KILO_TAB_STOP);
+            cur_rx += w;
+            col += w;
+        } else if (ascii) {
+            cur_rx++;
+            col++;
+        } else {
+            unsigned cp;
+            n = utf8_decode(&chars[cx], size - cx, &cp);
+            cur_rx += n;
+            col += utf8_char_width(cp);
         }
-        cur_rx++;
         if (cur_rx > rx)
         {
-            return cx;
+            return off + cx;
+        }
+        cx += n;
+    }
+
+    return off + cx;
+
+}
+
+void editor_free_chunk(Echunk *ch) {
+    free(ch->chars);
+    free(ch->render);
+    free(ch->hl);
+}
+
+// 选一个不切断 UTF-8 多字节序列的切分点
+int editor_chunk_split_point(const char *s, int len, int want) {
+    if (want >= len) {
+        return len;
+    }
+    int at = want;
+    while (at > want / 2 && ((unsigned char)s[at] & 0xC0) == 0x80) {
+        at--;
+    }
+    return at;
+}
+
+// 把 s 切成若干 chunk 插入到 row->chunks 的 at 处，只拷贝字符，不渲染
+void editor_row_insert_chunks(Erow *row, int at, const char *s, int len) {
+    int n = 0;
+    int pos = 0;
+    do {
+        pos += editor_chunk_split_point(s + pos, len - pos, KILO_CHUNK_SIZE);
+        n++;
+    } while (pos < len);
+
+    row->chunks = realloc(row->chunks, sizeof(Echunk) * (row->nchunks + n));
+    memmove(&row->chunks[at + n], &row->chunks[at],
+            sizeof(Echunk) * (row->nchunks - at));
+    row->nchunks += n;
+
+    pos = 0;
+    for (int j = at; j < at + n; j++) {
+        int take = editor_chunk_split_point(s + pos, len - pos, KILO_CHUNK_SIZE);
+        Echunk *ch = &row->chunks[j];
+        memset(ch, 0, sizeof(*ch));
+        ch->size = take;
+        ch->chars = malloc(take + 1);
+        memcpy(ch->chars, s + pos, take);
+        ch->chars[take] = '\0';
+        ch->tabs = editor_count_tabs(ch->chars, take);
+        pos += take;
+    }
+}
+
+void editor_row_chunkify(Erow *row) {
+    editor_row_insert_chunks(row, 0, row->chars, row->size);
+    free(row->chars);
+    free(row->render);
+    free(row->hl);
+    row->chars = NULL;
+    row->render = NULL;
+    row->hl = NULL;
+}
+
+void editor_row_unchunkify(Erow *row) {
+    row->chars = malloc(row->size + 1);
+    char *p = row->chars;
+    for (int j = 0; j < row->nchunks; j++) {
+        memcpy(p, row->chunks[j].chars, row->chunks[j].size);
+        p += row->chunks[j].size;
+        editor_free_chunk(&row->chunks[j]);
+    }
+    *p = '\0';
+    free(row->chunks);
+    row->chunks = NULL;
+    row->nchunks = 0;
+}
+
+// 从第 from 个 chunk 起重新渲染；新切出来（render 为 NULL）的 chunk 以及列
+// 偏移打乱了 tab 对齐的 chunk 才重算，其余的只平移 rstart/cstart，平移量是
+// tab 宽度的倍数之后就不再往下看。重新渲染的 chunk 先沿用旧的 hl（新增部分
+// 为普通色）立即可画；edit 为真时第 from 个 chunk 是刚编辑过的，它之前的
+// 高亮有效就在这里同步高亮，之后出口状态变了的 chunk 交给后台
+void editor_refresh_chunks(Erow *row, int from, int edit) {
+    int rx = 0, col = 0;
+    if (from > 0) {
+        rx = row->chunks[from - 1].rstart + row->chunks[from - 1].rsize;
+        col = row->chunks[from - 1].cstart + row->chunks[from - 1].cols;
+    }
+    if (row->hl_chunk > from) {
+        row->hl_chunk = from;
+    }
+    int start = col, end = col, old_cols = row->cols;
+
+    for (int j = from; j < row->nchunks; j++) {
+        Echunk *ch = &row->chunks[j];
+        int rerender = j == from || ch->render == NULL ||
+                       (ch->tabs && (ch->cstart - col) % KILO_TAB_STOP != 0);
+        if (!rerender && (col - ch->cstart) % KILO_TAB_STOP == 0) {
+            // 之后的 chunk 渲染结果都不变，整体平移即可
+            int drx = rx - ch->rstart, dcol = col - ch->cstart;
+            Echunk *last = &row->chunks[row->nchunks - 1];
+            rx = last->rstart + last->rsize + drx;
+            col = last->cstart + last->cols + dcol;
+            if (drx != 0 || dcol != 0) {
+                for (; j < row->nchunks; j++) {
+                    row->chunks[j].rstart += drx;
+                    row->chunks[j].cstart += dcol;
+                }
+            }
+            break;
+        }
+        ch->rstart = rx;
+        ch->cstart = col;
+        if (rerender) {
+            int old_rsize = ch->hl ? ch->rsize : 0;
+            free(ch->render);
+            ch->render = malloc(ch->size + ch->tabs * (KILO_TAB_STOP - 1) + 1);
+            ch->ascii = utf8_is_ascii(ch->chars, ch->size);
+            ch->rsize = editor_render_chars(ch->chars, ch->size, ch->cstart,
+                                            ch->ascii, ch->render, &ch->cols);
+            ch->hl = realloc(ch->hl, ch->rsize + 1);
+            if (ch->rsize > old_rsize) {
+                memset(&ch->hl[old_rsize], HL_NORMAL, ch->rsize - old_rsize);
+            }
+            ch->epoch = ++E.hl_seq;
+            end = ch->cstart + ch->cols;
+        }
+        rx += ch->rsize;
+        col += ch->cols;
+    }
+    row->rsize = rx;
+    row->cols = col;
+    row->epoch = ++E.hl_seq;
+
+    if (edit && row->hl_chunk == from && from < row->nchunks) {
+        editor_highlight_chunk(row, from);
+        row->hl_chunk++;
+    }
+    editor_row_hl_advance(row);
+    if (row->hl_chunk < row->nchunks) {
+        editor_hl_mark(row - E.erow);
+    }
+    editor_wrap_update_chunks(row, start, end, row->cols - old_cols);
+}
+
+void editor_wrap_push(int **wrap, int *nwrap, int *cap, int col) {
+    if (*nwrap == *cap) {
+        *cap *= 2;
+        *wrap = realloc(*wrap, sizeof(int) * *cap);
+    }
+    (*wrap)[(*nwrap)++] = col;
+}
+
+// 逐字符扫描一段 render，断点追加到 wrap，col 为当前显示列，brk 为最近一个
+// 空白之后的列。刚断开时 brk 不超过断点，所以从任一断点的列重新扫描
+// （brk 取断点本身）得到的后续断点与从头扫描相同
+void editor_wrap_scan(int **wrap, int *nwrap, int *cap, const char *render,
+                      int len, int ascii, int *col, int *brk) {
+    int width = E.screen_cols;
+    for (int i = 0; i < len;) {
+        int n = 1, w = 1;
+        if (!ascii) {
+            unsigned cp;
+            n = utf8_decode(&render[i], len - i, &cp);
+            w = utf8_char_width(cp);
+        }
+        int seg = (*wrap)[*nwrap - 1];
+        if (*col + w > seg + width && *col > seg) {
+            // 优先在空白之后断开，放不下时按字符断开
+            int at = (*brk > seg && *col + w - *brk <= width) ? *brk : *col;
+            editor_wrap_push(wrap, nwrap, cap, at);
+        }
+        *col += w;
+        if (render[i] == ' ') {
+            *brk = *col;
+        }
+        i += n;
+    }
+}
+
+// 按当前屏幕宽度计算 row 的软换行位置
+void editor_wrap_row(Erow *row) {
+    int width = E.screen_cols;
+    int cap = 4;
+    free(row->wrap);
+    row->wrap = malloc(sizeof(int) * cap);
+    row->wrap[0] = 0;
+    row->nwrap = 1;
+    row->wrap_w = width;
+    if (row->cols <= width) {
+        return;
+    }
+
+    if (row->chunks == NULL && row->ascii) {
+        // ASCII 行 render 下标即显示列，从每段末尾向前找空白即可
+        int seg = 0;
+        while (row->cols - seg > width) {
+            int at = seg + width;
+            while (at > seg && row->render[at - 1] != ' ') {
+                at--;
+            }
+            if (at == seg) {
+                at = seg + width;
+            }
+            editor_wrap_push(&row->wrap, &row->nwrap, &cap, at);
+            seg = at;
+        }
+        return;
+    }
+
+    int col = 0, brk = 0;
+    if (row->chunks) {
+        for (int j = 0; j < row->nchunks; j++) {
+            Echunk *ch = &row->chunks[j];
+            editor_wrap_scan(&row->wrap, &row->nwrap, &cap, ch->render,
+                             ch->rsize, ch->ascii, &col, &brk);
+        }
+    } else {
+        editor_wrap_scan(&row->wrap, &row->nwrap, &cap, row->render,
+                         row->rsize, 0, &col, &brk);
+    }
+}
+
+// 行内容变化后调用：软换行模式下立即重算并更新前缀和
+void editor_wrap_update(Erow *row) {
+    row->wrap_w = 0;
+    if (!E.wrap) {
+        return;
+    }
+    int old = row->nwrap;
+    editor_wrap_row(row);
+    int at = row - E.erow;
+    if (!E.wrap_stale && at < E.wrap_lines.n) {
+        fenwick_add(&E.wrap_lines, at, row->nwrap - old);
+    }
+}
+
+// 打开软换行或屏幕宽度变化后重建前缀和，只有失效的行才重新计算换行位置
+void editor_wrap_sync(void) {
+    if (!E.wrap_stale) {
+        return;
+    }
+    if (fenwick_reset(&E.wrap_lines, E.row_num) == -1) {
+        die("fenwick_reset");
+    }
+    for (int j = 0; j < E.row_num; j++) {
+        Erow *row = &E.erow[j];
+        if (row->wrap_w != E.screen_cols) {
+            editor_wrap_row(row);
+        }
+        fenwick_set(&E.wrap_lines, j, row->nwrap);
+    }
+    E.wrap_stale = 0;
+}
+
+// 光标所在显示列落在 row 的第几个屏幕行
+int editor_wrap_line_at(Erow *row, int col) {
+    int lo = 0, hi = row->nwrap - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (row->wrap[mid] <= col) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return lo;
+}
+
+// 显示列 col 在 chunk render 中的下标，col 须落在字符开头
+int editor_chunk_col_to_rx(Echunk *ch, int col) {
+    if (ch->ascii) {
+        return col - ch->cstart;
+    }
+    int rx = 0;
+    for (int c = ch->cstart; c < col && rx < ch->rsize;) {
+        unsigned cp;
+        rx += utf8_decode(&ch->render[rx], ch->rsize - rx, &cp);
+        c += utf8_char_width(cp);
+    }
+    return rx;
+}
+
+// 在 wrap[lo, hi) 中二分查找 col，找不到返回 -1
+int editor_wrap_find(const int *wrap, int lo, int hi, int col) {
+    int end = hi;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (wrap[mid] < col) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo < end && wrap[lo] == col ? lo : -1;
+}
+
+// 超长行从显示列 start 起被改动、end 之后的内容只平移了 delta 列时增量更新
+// 软换行：从 start 所在屏幕行的上一行开头重新扫描（这一行的断点可能由 start
+// 之后的字符决定），新断点落在 end 之后又与某个旧断点平移后重合时，之后的
+// 断点直接平移。前缀和只改这一行
+void editor_wrap_update_chunks(Erow *row, int start, int end, int delta) {
+    if (!E.wrap || row->wrap_w != E.screen_cols) {
+        editor_wrap_update(row);
+        return;
+    }
+    int old = row->nwrap;
+    int line = editor_wrap_line_at(row, start);
+    int keep = line > 0 ? line - 1 : 0; // 保留 wrap[0, keep]
+    int cap = 16, n = 1;
+    int *wrap = malloc(sizeof(int) * cap);
+    wrap[0] = row->wrap[keep];
+
+    int col = wrap[0], brk = col;
+    int j = editor_row_chunk_at_col(row, col);
+    int rx = editor_chunk_col_to_rx(&row->chunks[j], col);
+    int checked = 1, m = -1;
+    for (; j < row->nchunks && m == -1; j++, rx = 0) {
+        Echunk *ch = &row->chunks[j];
+        editor_wrap_scan(&wrap, &n, &cap, ch->render + rx, ch->rsize - rx,
+                         ch->ascii, &col, &brk);
+        for (; checked < n && m == -1; checked++) {
+            if (wrap[checked] >= end) {
+                m = editor_wrap_find(row->wrap, keep + 1, old,
+                                     wrap[checked] - delta);
+            }
+        }
+    }
+
+    // wrap[0, keep) + 新扫描的 wrap[0, fresh) + 旧的 wrap[m, old) 平移 delta
+    int fresh = m == -1 ? n : checked - 1;
+    int tail = m == -1 ? 0 : old - m;
+    int total = keep + fresh + tail;
+    if (total > old) {
+        row->wrap = realloc(row->wrap, sizeof(int) * total);
+    }
+    if (tail > 0) {
+        memmove(&row->wrap[keep + fresh], &row->wrap[m], sizeof(int) * tail);
+        for (int t = keep + fresh; t < total; t++) {
+            row->wrap[t] += delta;
+        }
+    }
+    memcpy(&row->wrap[keep], wrap, sizeof(int) * fresh);
+    free(wrap);
+    row->nwrap = total;
+
+    int at = row - E.erow;
+    if (!E.wrap_stale && at < E.wrap_lines.n) {
+        fenwick_set(&E.wrap_lines, at, row->nwrap);
+    }
+}
+
+void editor_toggle_wrap(void) {
+    E.wrap = !E.wrap;
+    E.coloff = 0;
+    if (E.wrap) {
+        E.wrap_stale = 1;
+        editor_wrap_sync();
+        E.voff = fenwick_prefix(&E.wrap_lines, E.rowoff);
+    }
+    editor_set_status_message("Soft wrap %s", E.wrap ? "on" : "off");
+}
+
+void editor_update_row(Erow *row) {
+    if (row->chunks == NULL && row->size > KILO_LONG_ROW) {
+        editor_row_chunkify(row);
+    }
+    if (row->chunks) {
+        editor_refresh_chunks(row, 0, 0);
+        return;
+    }
+
+    int tabs = editor_count_tabs(row->chars, row->size);
+    int old_rsize = row->hl ? row->rsize : 0;
+
+    free(row->render);
+    row->render = malloc(row->size + tabs * (KILO_TAB_STOP - 1) + 1);
+    row->ascii = utf8_is_ascii(row->chars, row->size);
+    row->rsize = editor_render_chars(row->chars, row->size, 0, row->ascii,
+                                     row->render, &row->cols);
+    editor_wrap_update(row);
+
+    editor_update_syntax(row, old_rsize);
+}
+
+// 第 k 个 chunk 的内容被修改后调用：维持 chunk 大小，只重算受影响的部分
+void editor_update_chunk(Erow *row, int k) {
+    if (row->size < KILO_LONG_ROW / 2) {
+        editor_row_unchunkify(row);
+        editor_update_row(row);
+        return;
+    }
+
+    Echunk *ch = &row->chunks[k];
+    if (ch->size > 2 * KILO_CHUNK_SIZE) {
+        Echunk old = *ch;
+        memmove(&row->chunks[k], &row->chunks[k + 1],
+                sizeof(Echunk) * (row->nchunks - k - 1));
+        row->nchunks--;
+        editor_row_insert_chunks(row, k, old.chars, old.size);
+        editor_free_chunk(&old);
+    } else if (ch->size == 0 && row->nchunks > 1) {
+        editor_free_chunk(ch);
+        memmove(&row->chunks[k], &row->chunks[k + 1],
+                sizeof(Echunk) * (row->nchunks - k - 1));
+        row->nchunks--;
+    }
+    editor_refresh_chunks(row, k, 1);
+}
+
+// 保证 E.erow 至少能容纳 n 行，按倍数扩容
+void editor_reserve_rows(int n) {
+    if (n <= E.row_cap) {
+        return;
+    }
+    int cap = E.row_cap ? E.row_cap : 16;
+    while (cap < n) {
+        cap *= 2;
+    }
+    E.erow = realloc(E.erow, sizeof(Erow) * cap);
+    if (E.erow == NULL) {
+        die("realloc");
+    }
+    E.row_cap = cap;
+}
+
+// 第 at 行及之后的内容与磁盘不再一致
+void editor_mark_dirty(int at) {
+    if (at < E.first_dirty) {
+        E.first_dirty = at;
+    }
+}
+
+void editor_insert_row(int at, const char *s, size_t len) {
+    if (at < 0 || at > E.row_num)
+    {
+        return;
+    }
+
+    editor_reserve_rows(E.row_num + 1);
+    memmove(&E.erow[at+1], &E.erow[at], sizeof(Erow) * (E.row_num - at));
+
+    // int at = E.row_num;
+    E.erow[at].size = len;
+    E.erow[at].chars = malloc(len + 1);
+    memcpy(E.erow[at].chars, s, len);
+    E.erow[at].chars[len] = '\0';
+
+    E.erow[at].rsize = 0;
+    E.erow[at].cols = 0;
+    E.erow[at].ascii = 1;
+    E.erow[at].render = NULL;
+    E.erow[at].hl = NULL;
+    E.erow[at].epoch = 0;
+    E.erow[at].hl_epoch = 0;
+    E.erow[at].hl_begin_comment = 0;
+    E.erow[at].hl_open_comment = 0;
+    E.erow[at].nchunks = 0;
+    E.erow[at].chunks = NULL;
+    E.erow[at].hl_chunk = 0;
+    E.erow[at].wrap_w = 0;
+    E.erow[at].nwrap = 1;
+    E.erow[at].wrap = NULL;
+    E.row_num++;
+    editor_mark_dirty(at);
+    if (E.wrap && !E.wrap_stale && fenwick_insert(&E.wrap_lines, at, 1) == -1) {
+        die("fenwick_insert");
+    }
+    if (E.loading && at < E.load_row) {
+        E.load_row++;
+    }
+    if (E.hl_dirty_from < E.hl_dirty_to) {
+        // 待高亮区间随插入下移
+        if (at < E.hl_dirty_from)
+            E.hl_dirty_from++;
+        if (at < E.hl_dirty_to)
+            E.hl_dirty_to++;
+    }
+    editor_update_row(&E.erow[at]);
+
+    E.dirty++;
+}
+
+void editor_free_row(Erow *row){
+    free(row->render);
+    free(row->chars);
+    free(row->hl);
+    for (int j = 0; j < row->nchunks; j++) {
+        editor_free_chunk(&row->chunks[j]);
+    }
+    free(row->chunks);
+    free(row->wrap);
+}
+
+void editor_del_row(int at){
+    if (at < 0 || at >= E.row_num)
+    {
+        return;
+    }
+    editor_free_row(&E.erow[at]);
+    memmove(&E.erow[at], &E.erow[at + 1], sizeof(Erow) * (E.row_num - at -1));
+    editor_mark_dirty(at);
+    E.row_num--;
+    if (E.wrap && !E.wrap_stale) {
+        fenwick_delete(&E.wrap_lines, at);
+    }
+    if (E.loading && at < E.load_row) {
+        E.load_row--;
+    }
+    if (E.hl_dirty_from < E.hl_dirty_to) {
+        if (at < E.hl_dirty_from)
+            E.hl_dirty_from--;
+        if (at < E.hl_dirty_to)
+            E.hl_dirty_to--;
+    }
+    // 被删的行可能开启或关闭了多行注释，下一行的入口状态需要重新检查
+    editor_hl_mark(at);
+    E.dirty++;
+
+}
+
+void editor_row_insert_char(Erow *row, int at, int c) {
+    if (at < 0 || at > row->size)
+        at = row->size;
+    editor_mark_dirty(row - E.erow);
+    if (row->chunks) {
+        int off;
+        int k = editor_row_chunk_at(row, at, &off);
+        Echunk *ch = &row->chunks[k];
+        at -= off;
+        ch->chars = realloc(ch->chars, ch->size + 2);
+        memmove(&ch->chars[at + 1], &ch->chars[at], ch->size - at + 1);
+        ch->size++;
+        ch->chars[at] = c;
+        if (c == '\t')
+            ch->tabs++;
+        row->size++;
+        editor_update_chunk(row, k);
+        E.dirty++;
+        return;
+    }
+    row->chars = realloc(row->chars, row->size + 2);
+    memmove(&row->chars[at + 1], &row->chars[at], row->size - at + 1);
+    row->size++;
+    row->chars[at] = c;
+    editor_update_row(row);
+    E.dirty++;
+}
+
+void editor_row_appen_string(Erow *row, char *s, size_t len) {
+    editor_mark_dirty(row - E.erow);
+    if (row->chunks) {
+        int k = row->nchunks - 1;
+        Echunk *ch = &row->chunks[k];
+        ch->chars = realloc(ch->chars, ch->size + len + 1);
+        memcpy(&ch->chars[ch->size], s, len);
+        ch->size += len;
+        ch->chars[ch->size] = '\0';
+        ch->tabs += editor_count_tabs(s, len);
+        row->size += len;
+        editor_update_chunk(row, k);
+        E.dirty++;
+        return;
+    }
+    row->chars = realloc(row->chars, row->size + len + 1);
+    memcpy(&row->chars[row->size], s, len);
+    row->size += len;
+    row->chars[row->size] = '\0';
+    editor_update_row(row);
+    E.dirty++;
+}
+
+// 把 [at, at + len) 的字符拷贝到 dst，跨 chunk 也可用
+void editor_row_copy_chars(Erow *row, int at, int len, char *dst) {
+    if (row->chunks == NULL) {
+        memcpy(dst, &row->chars[at], len);
+        return;
+    }
+    int off = 0;
+    for (int j = 0; j < row->nchunks && len > 0; j++) {
+        Echunk *ch = &row->chunks[j];
+        if (at < off + ch->size) {
+            int n = off + ch->size - at;
+            if (n > len)
+                n = len;
+            memcpy(dst, &ch->chars[at - off], n);
+            dst += n;
+            at += n;
+            len -= n;
+        }
+        off += ch->size;
+    }
+}
+
+// 第 at 个字节，跨 chunk 也可用；at == size 时返回 '\0'
+char editor_row_char_at(Erow *row, int at) {
+    if (at >= row->size) {
+        return '\0';
+    }
+    if (row->chunks == NULL) {
+        return row->chars[at];
+    }
+    int off;
+    int k = editor_row_chunk_at(row, at, &off);
+    if (at - off == row->chunks[k].size) {
+        off += row->chunks[k].size;
+        k++;
+    }
+    return row->chunks[k].chars[at - off];
+}
+
+// at 落在多字节字符中间时退回该字符开头
+int editor_row_char_start(Erow *row, int at) {
+    while (at > 0 && utf8_is_cont(editor_row_char_at(row, at))) {
+        at--;
+    }
+    return at;
+}
+
+// 下一个字符的开头
+int editor_row_char_next(Erow *row, int at) {
+    at++;
+    while (at < row->size && utf8_is_cont(editor_row_char_at(row, at))) {
+        at++;
+    }
+    return at;
+}
+
+void editor_row_truncate(Erow *row, int at) {
+    editor_mark_dirty(row - E.erow);
+    if (row->chunks) {
+        int off;
+        int k = editor_row_chunk_at(row, at, &off);
+        for (int j = k + 1; j < row->nchunks; j++) {
+            editor_free_chunk(&row->chunks[j]);
+        }
+        row->nchunks = k + 1;
+        Echunk *ch = &row->chunks[k];
+        ch->size = at - off;
+        ch->chars[ch->size] = '\0';
+        ch->tabs = editor_count_tabs(ch->chars, ch->size);
+        row->size = at;
+        editor_update_chunk(row, k);
+        return;
+    }
+    row->size = at;
+    row->chars[row->size] = '\0';
+    editor_update_row(row);
+}
+
+void editor_insert_char(int c) {
+    if (E.cursor_y == E.row_num) {
+        editor_insert_row(E.row_num, "", 0);
+    }
+    editor_row_insert_char(&E.erow[E.cursor_y], E.cursor_x, c);
+    E.cursor_x++;
+}
+
+void editor_insert_new_line(void) {
+    if (E.cursor_x == 0)
+    {
+        editor_insert_row(E.cursor_y, "", 0);
+    }else
+    {
+        Erow *row = &E.erow[E.cursor_y];
+        if (row->size - 1 > E.cursor_x)
+        {
+            int tail_len = row->size - E.cursor_x;
+            char *tail = malloc(tail_len);
+            editor_row_copy_chars(row, E.cursor_x, tail_len, tail);
+            editor_insert_row(E.cursor_y + 1, tail, tail_len);
+            free(tail);
+            editor_row_truncate(&E.erow[E.cursor_y], E.cursor_x);
+        }else {
+            E.cursor_x = 0;
+            editor_insert_row(E.cursor_y + 1, "", 0);
+        }
+    }
+
+    E.cursor_y++;
+    E.dirty++;
+
+}
+
+void editor_row_del_char(Erow *row, int at) {
+    if (at < 0 || at >= row->size) {
+        return;
+    }
+    editor_mark_dirty(row - E.erow);
+    if (row->chunks) {
+        int off;
+        int k = editor_row_chunk_at(row, at, &off);
+        if (at - off == row->chunks[k].size) {
+            off += row->chunks[k].size;
+            k++;
+        }
+        Echunk *ch = &row->chunks[k];
+        at -= off;
+        if (ch->chars[at] == '\t')
+            ch->tabs--;
+        memmove(&ch->chars[at], &ch->chars[at + 1], ch->size - at);
+        ch->size--;
+        row->size--;
+        editor_update_chunk(row, k);
+        E.dirty++;
+        return;
+    }
+    memmove(&row->chars[at], &row->chars[at + 1], row->size - at);
+    row->size--;
+    editor_update_row(row);
+    E.dirty++;
+}
+
+void editor_del_char(void) {
+    if (E.cursor_y == E.row_num) {
+        return;
+    }
+    if (E.cursor_x == 0 && E.cursor_y == 0)
+    {
+        return;
+    }
+
+    Erow *row = &E.erow[E.cursor_y];
+    if (E.cursor_x > 0) {
+        // 整个多字节字符一起删掉
+        int start = editor_row_char_start(row, E.cursor_x - 1);
+        while (E.cursor_x > start) {
+            editor_row_del_char(row, E.cursor_x - 1);
+            E.cursor_x--;
+        }
+    } else
+    {
+        E.cursor_x = E.erow[E.cursor_y - 1].size;
+        if (row->chunks) {
+            char *chars = malloc(row->size);
+            editor_row_copy_chars(row, 0, row->size, chars);
+            editor_row_appen_string(&E.erow[E.cursor_y-1], chars, row->size);
+            free(chars);
+        } else {
+            editor_row_appen_string(&E.erow[E.cursor_y-1], row->chars, row->size);
+        }
+        editor_del_row(E.cursor_y);
+        E.cursor_y--;
+    }
+}
+
+// 拼接第 from 行起的所有行，每行以 \n 结尾
+char *editor_rows_to_string(int from, size_t *buflen) {
+    size_t tolen = 0;
+    int j;
+    for (j = from; j < E.row_num; j++) {
+        tolen += E.erow[j].size + 1;
+    }
+    *buflen = tolen;
+    char *buf = malloc(tolen + 1);
+    char *p = buf;
+    for (j = from; j < E.row_num; j++) {
+        editor_row_copy_chars(&E.erow[j], 0, E.erow[j].size, p);
+        p += E.erow[j].size;
+        *p = '\n';
+        p++;
+    }
+
+    return buf;
+}
+
+// 在整行 render 中查找 query，返回匹配所在列，找不到返回 -1
+int editor_row_find(Erow *row, const char *query) {
+    if (row->chunks == NULL) {
+        char *match = strstr(row->render, query);
+        return match ? match - row->render : -1;
+    }
+
+    int qlen = strlen(query);
+    char *window = malloc(2 * qlen + 1);
+    int found = -1;
+    for (int j = 0; j < row->nchunks && found == -1; j++) {
+        Echunk *ch = &row->chunks[j];
+        char *match = strstr(ch->render, query);
+        if (match) {
+            found = ch->rstart + (match - ch->render);
+        } else if (j + 1 < row->nchunks && qlen > 1) {
+            // 跨 chunk 边界的匹配：拼接两侧各 qlen - 1 个字符再找
+            Echunk *next = &row->chunks[j + 1];
+            int a = ch->rsize < qlen - 1 ? ch->rsize : qlen - 1;
+            int b = next->rsize < qlen - 1 ? next->rsize : qlen - 1;
+            memcpy(window, ch->render + ch->rsize - a, a);
+            memcpy(window + a, next->render, b);
+            window[a + b] = '\0';
+            match = strstr(window, query);
+            if (match) {
+                found = ch->rstart + ch->rsize - a + (match - window);
+            }
+        }
+    }
+    free(window);
+    return found;
+}
+
+// 读取（store 为 0）或写回（store 为 1）render 列 [rx, rx + len) 上的高亮
+void editor_row_copy_hl(Erow *row, int rx, int len, unsigned char *buf,
+                        int store) {
+    if (row->chunks == NULL) {
+        if (store) {
+            memcpy(&row->hl[rx], buf, len);
+        } else {
+            memcpy(buf, &row->hl[rx], len);
+        }
+        return;
+    }
+    for (int j = editor_row_chunk_at_rx(row, rx); j < row->nchunks && len > 0;
+         j++) {
+        Echunk *ch = &row->chunks[j];
+        int n = ch->rstart + ch->rsize - rx;
+        if (n > len)
+            n = len;
+        if (n <= 0)
+            continue;
+        if (store) {
+            memcpy(&ch->hl[rx - ch->rstart], buf, n);
+        } else {
+            memcpy(buf, &ch->hl[rx - ch->rstart], n);
+        }
+        buf += n;
+        rx += n;
+        len -= n;
+    }
+}
+
+// 把按行索引好的数据（offsets 共 count + 1 项）插入到第 at 行起
+void editor_insert_lines(int at, const char *data, const size_t *offsets,
+                         size_t count) {
+    editor_reserve_rows(E.row_num + count);
+    for (size_t i = 0; i < count; i++) {
+        const char *line = &data[offsets[i]];
+        size_t line_len = offsets[i + 1] - offsets[i];
+        while (line_len > 0 &&
+               (line[line_len - 1] == '\n' || line[line_len - 1] == '\r')) {
+            if (line[line_len - 1] == '\r')
+                E.disk_crlf = 1;
+            line_len--;
+        }
+        editor_insert_row(at + i, line, line_len);
+    }
+}
+
+void editor_load_apply(struct load_batch *batch) {
+    int dirty = E.dirty;
+    int first_dirty = E.first_dirty;
+    if (first_dirty != INT_MAX && first_dirty >= E.load_row) {
+        first_dirty += batch->count;
+    }
+    if (batch->count > 0) {
+        editor_insert_lines(E.load_row, batch->data, batch->offsets,
+                            batch->count);
+        lineidx_append(&E.lidx, batch->offsets, batch->count,
+                       batch->file_offset);
+    }
+    E.load_row += batch->count;
+    E.dirty = dirty; // 加载进来的行不算修改
+    E.first_dirty = first_dirty;
+    E.load_bytes = batch->loaded;
+    E.load_total = batch->total;
+    if (batch->error != NULL) {
+        E.readonly = 1;
+        editor_set_status_message("Can't read %s: %s (read-only)", E.filename,
+                                  batch->error);
+    }
+    if (batch->done) {
+        E.loading = 0;
+        E.load_fd = -1;
+        load_buffer = -1;
+        loader_close();
+    }
+    load_batch_free(batch);
+    if (!E.loading) {
+        // 加载期间追加的内容
+        editor_check_disk();
+    }
+}
+
+// 阻塞等待并应用下一批加载结果
+void editor_load_next(void) {
+    struct pollfd pfd = {E.load_fd, POLLIN, 0};
+    while (poll(&pfd, 1, -1) == -1) {
+        if (errno != EINTR)
+            die("poll");
+    }
+    struct load_batch *batch = loader_take();
+    if (batch) {
+        editor_load_apply(batch);
+    }
+}
+
+int editor_load_percent(void) {
+    return E.load_total ? (int)(E.load_bytes * 100 / E.load_total) : 100;
+}
+
+// 需要的行还没加载到时阻塞等待，只有越过加载前沿才会走到这里
+void editor_load_until(int rows) {
+    while (E.loading && E.row_num < rows) {
+        editor_set_status_message("Loading... %d%%", editor_load_percent());
+        editor_refresh_screen();
+        editor_load_next();
+    }
+}
+
+// 读入整个文件：普通文件用 read，gzip 文件解压到内存。不用 mmap：读的同时
+// 文件被别的进程截短时访问映射会收到 SIGBUS，read 只是读到较短的内容。
+// gzip 数据损坏时返回已解压的部分，*err 指向错误信息，否则为 NULL
+char *editor_read_file(int fd, size_t size, size_t *len, const char **err) {
+    char *buf;
+    *err = NULL;
+    if (E.gzip) {
+        buf = gzio_read(fd, len, err);
+        if (buf == NULL)
+            die("gzio_read");
+        return buf;
+    }
+    buf = malloc(size ? size : 1);
+    if (buf == NULL)
+        die("malloc");
+    size_t n = 0;
+    while (n < size) {
+        ssize_t got = pread(fd, buf + n, size - n, n);
+        if (got == -1 && errno == EINTR)
+            continue;
+        if (got == -1)
+            die("read");
+        if (got == 0)
+            break;
+        n += got;
+    }
+    *len = n;
+    return buf;
+}
+
+void editor_open(const char *filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1)
+        die("open");
+
+    struct stat st;
+    if (fstat(fd, &st) == -1)
+        die("fstat");
+
+    free(E.filename);
+    E.filename = strdup(filename);
+
+    editor_select_syntax_highlight();
+    lineidx_free(&E.lidx);
+    E.disk_st = st;
+    E.disk_known = 1;
+    E.disk_crlf = 0;
+    E.disk_changed = 0;
+    E.gzip = gzio_detect(fd);
+    E.watch_wd = watch_file(E.watch_fd, E.watch_wd, filename);
+
+    // 大文件交给后台线程流式加载，拿到很小的首批就可以画首屏；
+    // gzip 文件解压后的大小事先不知道，总是流式加载
+    if (((size_t)st.st_size >= KILO_STREAM_MIN || E.gzip) && load_buffer == -1 &&
+        (E.load_fd = loader_start(filename)) != -1) {
+        close(fd);
+        E.loading = 1;
+        load_buffer = buffer_cur;
+        E.load_row = E.row_num;
+        E.load_bytes = 0;
+        E.load_total = st.st_size;
+        editor_load_next();
+        E.dirty = 0;
+        E.first_dirty = INT_MAX;
+        return;
+    }
+
+    size_t len;
+    const char *err;
+    char *buf = editor_read_file(fd, st.st_size, &len, &err);
+    close(fd);
+    if (err != NULL) {
+        E.readonly = 1;
+        editor_set_status_message("Can't read %s: %s (read-only)", filename, err);
+    }
+
+    // 先并行建立行索引，再一次性预留好所有行
+    if (lineidx_build(&E.lidx, buf, len) == -1)
+        die("lineidx_build");
+    editor_insert_lines(E.row_num, buf, E.lidx.offsets, E.lidx.lines);
+    free(buf);
+    E.dirty = 0;
+    E.first_dirty = INT_MAX;
+}
+
+// 保存成功后磁盘内容与各行一致：从第 from 行起重建行偏移，记下文件状态
+void editor_saved(int fd, int from) {
+    size_t base = 0;
+    if (from > 0) {
+        base = E.lidx.offsets[from];
+    }
+    size_t *offsets = malloc(sizeof(size_t) * (E.row_num - from + 1));
+    offsets[0] = 0;
+    for (int j = from; j < E.row_num; j++) {
+        offsets[j - from + 1] = offsets[j - from] + E.erow[j].size + 1;
+    }
+    E.lidx.lines = from;
+    if (lineidx_append(&E.lidx, offsets, E.row_num - from, base) == -1) {
+        die("lineidx_append");
+    }
+    free(offsets);
+
+    E.disk_known = fstat(fd, &E.disk_st) == 0;
+    E.disk_crlf = 0;
+    E.disk_changed = 0;
+    E.first_dirty = INT_MAX;
+    E.dirty = 0;
+}
+
+// st 与打开/上次保存时记下的文件状态一致
+int editor_disk_unchanged(const struct stat *st) {
+    return st->st_dev == E.disk_st.st_dev && st->st_ino == E.disk_st.st_ino &&
+           st->st_size == E.disk_st.st_size &&
+           st->st_mtim.tv_sec == E.disk_st.st_mtim.tv_sec &&
+           st->st_mtim.tv_nsec == E.disk_st.st_mtim.tv_nsec;
+}
+
+int editor_write_all(int fd, const char *buf, size_t len, off_t off) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = pwrite(fd, buf + done, len - done, off + done);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        done += n;
+    }
+    return 0;
+}
+
+// 文件自打开/上次保存后没被别人改过时，只从第一处修改所在的行开始原地
+// 重写，再截断到新长度，fdatasync 落盘后才算成功；不满足条件返回 -1，
+// 由调用者整体重写
+int editor_save_incremental(size_t *written) {
+    if (!E.disk_known || E.disk_crlf || E.gzip || E.lidx.offsets == NULL) {
+        return -1;
+    }
+    int fd = open(E.filename, O_RDWR);
+    if (fd == -1) {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) ||
+        !editor_disk_unchanged(&st) || (size_t)st.st_size != E.lidx.len) {
+        close(fd);
+        return -1;
+    }
+
+    int from = E.first_dirty;
+    if (from > E.row_num)
+        from = E.row_num;
+    if (from > (int)E.lidx.lines)
+        from = E.lidx.lines;
+    // 前一行在磁盘上不是 "内容\n"（文件末尾缺换行）时连它一起重写
+    while (from > 0 && E.lidx.offsets[from] - E.lidx.offsets[from - 1] !=
+                           (size_t)E.erow[from - 1].size + 1) {
+        from--;
+    }
+
+    off_t off = E.lidx.offsets[from];
+    size_t len;
+    char *buf = editor_rows_to_string(from, &len);
+    int ret = -1;
+    if (editor_write_all(fd, buf, len, off) == 0 &&
+        ftruncate(fd, off + len) == 0 && fdatasync(fd) == 0) {
+        editor_saved(fd, from);
+        *written = len;
+        ret = 0;
+    }
+    free(buf);
+    close(fd);
+    return ret;
+}
+
+// 写到同目录下的临时文件再 rename 覆盖，中途失败不会破坏原文件；
+// gzip 文件重新压缩后写回
+int editor_save_atomic(size_t *written) {
+    char path[PATH_MAX];
+    const char *target = E.filename;
+    if (realpath(E.filename, path) != NULL) {
+        target = path; // 符号链接保存到它指向的文件
+    }
+    char tmp[PATH_MAX + 16];
+    snprintf(tmp, sizeof(tmp), "%s.XXXXXX", target);
+    int fd = mkstemp(tmp);
+    if (fd == -1) {
+        return -1;
+    }
+
+    struct stat st;
+    mode_t mode;
+    if (stat(target, &st) == 0) {
+        mode = st.st_mode & 07777;
+    } else {
+        mode_t mask = umask(0);
+        umask(mask);
+        mode = 0644 & ~mask;
+    }
+
+    size_t len;
+    char *buf = editor_rows_to_string(0, &len);
+    int wrote = E.gzip ? gzio_write(fd, buf, len)
+                       : editor_write_all(fd, buf, len, 0);
+    if (fchmod(fd, mode) == -1 || wrote == -1 || fsync(fd) == -1 ||
+        rename(tmp, target) == -1) {
+        int saved_errno = errno;
+        unlink(tmp);
+        close(fd);
+        free(buf);
+        errno = saved_errno;
+        return -1;
+    }
+    editor_saved(fd, 0);
+    *written = len;
+    close(fd);
+    free(buf);
+    // rename 换了 inode，改为监视新文件
+    E.watch_wd = watch_file(E.watch_fd, E.watch_wd, E.filename);
+    return 0;
+}
+
+// 读取 [off, off + len)，返回实际读到的字节数
+size_t editor_read_all(int fd, char *buf, size_t len, off_t off) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = pread(fd, buf + done, len - done, off + done);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        done += n;
+    }
+    return done;
+}
+
+// 磁盘上的行 line（含行尾）与 row 内容相同；line 末尾的 \r 记入 disk_crlf
+int editor_row_matches(Erow *row, const char *line, size_t len) {
+    while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+        if (line[len - 1] == '\r')
+            E.disk_crlf = 1;
+        len--;
+    }
+    if (len != (size_t)row->size) {
+        return 0;
+    }
+    if (row->chunks == NULL) {
+        return memcmp(row->chars, line, len) == 0;
+    }
+    for (int j = 0; j < row->nchunks; j++) {
+        if (memcmp(row->chunks[j].chars, line, row->chunks[j].size) != 0) {
+            return 0;
+        }
+        line += row->chunks[j].size;
+    }
+    return 1;
+}
+
+// 文件只是在末尾追加了内容：只读入新的尾部，批量加到最后。
+// 原来的最后一行没有换行时追加的内容接在它后面，连它一起重读
+int editor_read_tail(const struct stat *st) {
+    int from = E.lidx.lines;
+    if (E.lidx.offsets == NULL || from != E.row_num || E.gzip) {
+        return -1;
+    }
+    if (from > 0 && E.lidx.offsets[from] - E.lidx.offsets[from - 1] !=
+                        (size_t)E.erow[from - 1].size + 1) {
+        from--;
+    }
+
+    int fd = open(E.filename, O_RDONLY);
+    if (fd == -1) {
+        return -1;
+    }
+    // 追加点之前的一行必须没变，排除截断后又写得更长的情况
+    if (from > 0) {
+        size_t start = E.lidx.offsets[from - 1];
+        size_t n = E.lidx.offsets[from] - start;
+        char *line = malloc(n);
+        int same = editor_read_all(fd, line, n, start) == n &&
+                   editor_row_matches(&E.erow[from - 1], line, n);
+        free(line);
+        if (!same) {
+            close(fd);
+            return -1;
+        }
+    }
+
+    size_t base = E.lidx.offsets[from];
+    size_t len = st->st_size - base;
+    char *buf = malloc(len + 1);
+    len = editor_read_all(fd, buf, len, base);
+    close(fd);
+
+    struct lineidx tail = LINEIDX_INIT;
+    if (lineidx_build(&tail, buf, len) == -1) {
+        die("lineidx_build");
+    }
+    int dirty = E.dirty;
+    if (from < E.row_num) {
+        editor_del_row(from);
+    }
+    editor_insert_lines(from, buf, tail.offsets, tail.lines);
+    E.lidx.lines = from;
+    if (lineidx_append(&E.lidx, tail.offsets, tail.lines, base) == -1) {
+        die("lineidx_append");
+    }
+    lineidx_free(&tail);
+    free(buf);
+
+    E.dirty = dirty;
+    E.first_dirty = INT_MAX;
+    E.disk_st = *st;
+    E.disk_st.st_size = base + len; // 读的同时可能又有追加，下次事件再读
+    if (E.follow && E.row_num > 0) {
+        E.cursor_y = E.row_num - 1;
+        E.cursor_x = 0;
+    }
+    return 0;
+}
+
+// 收到 inotify 事件后检查磁盘上的文件：没有未保存修改时，纯追加直接读入，
+// 其它改动提示用 Ctrl-R 重新加载
+void editor_check_disk(void) {
+    if (!E.disk_known || E.loading || E.evicted || E.filename == NULL) {
+        return;
+    }
+    struct stat st;
+    if (stat(E.filename, &st) == -1) {
+        E.disk_changed = 1;
+        editor_set_status_message("File removed from disk");
+        return;
+    }
+    if (editor_disk_unchanged(&st)) {
+        return;
+    }
+    if (st.st_ino != E.disk_st.st_ino || st.st_dev != E.disk_st.st_dev) {
+        // 文件被改名替换（很多程序这样保存），监视新的 inode
+        E.watch_wd = watch_file(E.watch_fd, E.watch_wd, E.filename);
+    }
+    if (!E.dirty && !E.readonly && st.st_dev == E.disk_st.st_dev &&
+        st.st_ino == E.disk_st.st_ino && st.st_size > E.disk_st.st_size &&
+        editor_read_tail(&st) == 0) {
+        return;
+    }
+    E.disk_changed = 1;
+    editor_set_status_message("File changed on disk. Ctrl-R = reload");
+}
+
+// 重新读入磁盘上的文件，与磁盘内容相同的前缀行（连同渲染、高亮结果）原样保留
+void editor_reload(void) {
+    if (E.filename == NULL) {
+        return;
+    }
+    editor_load_until(INT_MAX);
+    int fd = open(E.filename, O_RDONLY);
+    if (fd == -1) {
+        editor_set_status_message("Can't reload: %s", strerror(errno));
+        return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1)
+        die("fstat");
+    E.gzip = gzio_detect(fd);
+    size_t len;
+    const char *err;
+    char *buf = editor_read_file(fd, st.st_size, &len, &err);
+    close(fd);
+    if (err != NULL) {
+        free(buf);
+        editor_set_status_message("Can't reload: %s", err);
+        return;
+    }
+
+    struct lineidx idx = LINEIDX_INIT;
+    if (lineidx_build(&idx, buf, len) == -1)
+        die("lineidx_build");
+
+    E.disk_crlf = 0;
+    int keep = 0;
+    int limit = E.row_num < (int)idx.lines ? E.row_num : (int)idx.lines;
+    if (limit > E.first_dirty)
+        limit = E.first_dirty;
+    while (keep < limit &&
+           editor_row_matches(&E.erow[keep], buf + idx.offsets[keep],
+                              idx.offsets[keep + 1] - idx.offsets[keep])) {
+        keep++;
+    }
+    for (int j = E.row_num - 1; j >= keep; j--) {
+        editor_del_row(j);
+    }
+    editor_insert_lines(keep, buf, idx.offsets + keep, idx.lines - keep);
+    free(buf);
+
+    lineidx_free(&E.lidx);
+    E.lidx = idx;
+    E.disk_st = st;
+    E.disk_known = 1;
+    E.disk_changed = 0;
+    E.readonly = 0;
+    E.dirty = 0;
+    E.first_dirty = INT_MAX;
+    E.watch_wd = watch_file(E.watch_fd, E.watch_wd, E.filename);
+
+    if (E.cursor_y > E.row_num)
+        E.cursor_y = E.row_num;
+    if (E.cursor_y < E.row_num && E.cursor_x > E.erow[E.cursor_y].size)
+        E.cursor_x = E.erow[E.cursor_y].size;
+    editor_set_status_message("Reloaded, %d of %d lines unchanged", keep,
+                              E.row_num);
+}
+
+void editor_toggle_follow(void) {
+    E.follow = !E.follow;
+    if (E.follow && E.row_num > 0) {
+        E.cursor_y = E.row_num - 1;
+        E.cursor_x = 0;
+    }
+    editor_set_status_message("Tail follow %s", E.follow ? "on" : "off");
+}
+
+void editor_save(void) {
+    if (E.filename == NULL) {
+        E.filename = editor_prompt("Save as: %s", NULL);
+        if (E.filename == NULL)
+        {
+            editor_set_status_message("Save aborted");
+            return;
         }
+        editor_select_syntax_highlight();
+        E.disk_known = 0;
 
     }
-
-    return cx;
-
-}
-
-void editor_update_row(Erow *row) {
-    int tabs = 0;
-    int j;
-    for (int j = 0; j < row->size; j++) {
-        if (row->chars[j] == '\t')
-            tabs++;
+    editor_load_until(INT_MAX);
+    if (E.readonly) {
+        editor_set_status_message("File was not read completely, not saving");
+        return;
     }
 
-    free(row->render);
-    row->render = malloc(row->size + tabs * 7 + 1);
-    int idx = 0;
-    for (j = 0; j < row->size; j++) {
-        if (row->chars[j] == '\t') {
-            row->render[idx++] = ' ';
-            while (idx % KILO_TAB_STOP != 0) {
-                row->render[idx++] = ' ';
-            }
-
-        } else {
-            row->render[idx++] = row->chars[j];
-        }
+    // 两条路径返回成功时内容都已落盘。原地写入在写的过程中崩溃会留下前半是
+    // 新内容、后半是旧内容的文件（第一处修改之前的部分不会动）；整体重写
+    // 靠 rename 保证文件要么是旧的要么是新的。为了大文件改一行时保存只要
+    // 几毫秒，这里接受原地写入较弱的保证
+    size_t len;
+    if (editor_save_incremental(&len) == 0 || editor_save_atomic(&len) == 0) {
+        editor_set_status_message("%zu bytes written to disk", len);
+        return;
     }
+    editor_set_status_message("Can't save! I/O error: %s", strerror(errno));
+}
 
-    row->render[idx] = '\0';
-    row->rsize = idx;
-
-    editor_update_syntax(row);
+// 第 n 个 buffer 的状态，当前 buffer 在 E 中
+struct EditorConfig *editor_buffer_at(int n) {
+    return n == buffer_cur ? &E : &buffers[n];
 }
 
-void editor_insert_row(int at, char *s, size_t len) {
-    if (at < 0 || at > E.row_num)
-    {
+// 把 E 换成第 n 个 buffer；屏幕、终端、后台线程与状态栏消息属于整个编辑器，
+// 不随之交换。后台结果要应用到非当前 buffer 时也临时换进来再换回去
+void editor_buffer_swap(int n) {
+    if (n == buffer_cur) {
         return;
     }
-
-    E.erow = realloc(E.erow, sizeof(Erow) * (E.row_num + 1));
-    memmove(&E.erow[at+1], &E.erow[at], sizeof(Erow) * (E.row_num - at));
-
-    // int at = E.row_num;
-    E.erow[at].size = len;
-    E.erow[at].chars = malloc(len + 1);
-    memcpy(E.erow[at].chars, s, len);
-    E.erow[at].chars[len] = '\0';
-
-    E.erow[at].rsize = 0;
-    E.erow[at].render = NULL;
-    E.erow[at].hl = NULL;
-    editor_update_row(&E.erow[at]);
-
-    E.row_num++;
-    E.dirty++;
+    struct EditorConfig next = buffers[n];
+    next.screen_rows = E.screen_rows;
+    next.screen_cols = E.screen_cols;
+    next.watch_fd = E.watch_fd;
+    memcpy(next.statusmsg, E.statusmsg, sizeof(E.statusmsg));
+    next.statusmsg_time = E.statusmsg_time;
+    next.hl_seq = E.hl_seq;
+    next.hl_fd = E.hl_fd;
+    next.orig_termios = E.orig_termios;
+    buffers[buffer_cur] = E;
+    E = next;
+    buffer_cur = n;
 }
 
-void editor_free_row(Erow *row){
-    free(row->render);
-    free(row->chars);
-    free(row->hl);
+// 一次分配实际占用的内存：可用大小加上分配器的块头
+size_t editor_alloc_size(void *p) {
+    return p ? malloc_usable_size(p) + 2 * sizeof(size_t) : 0;
 }
 
-void editor_del_row(int at){
-    if (at < 0 || at >= E.row_num)
-    {
-        return;
+size_t editor_row_mem(const Erow *row) {
+    size_t mem = editor_alloc_size(row->chars) + editor_alloc_size(row->render) +
+                 editor_alloc_size(row->hl) + editor_alloc_size(row->wrap) +
+                 editor_alloc_size(row->chunks);
+    for (int j = 0; j < row->nchunks; j++) {
+        const Echunk *ch = &row->chunks[j];
+        mem += editor_alloc_size(ch->chars) + editor_alloc_size(ch->render) +
+               editor_alloc_size(ch->hl);
     }
-    editor_free_row(&E.erow[at]);
-    memmove(&E.erow[at], &E.erow[at + 1], sizeof(Erow) * (E.row_num - at -1));
-    E.row_num--;
-    E.dirty++;
-
+    return mem;
 }
 
-void editor_row_insert_char(Erow *row, int at, int c) {
-    if (at < 0 || at > row->size)
-        at = row->size;
-    row->chars = realloc(row->chars, row->size + 2);
-    memmove(&row->chars[at + 1], &row->chars[at], row->size - at + 1);
-    row->size++;
-    row->chars[at] = c;
-    editor_update_row(row);
-    E.dirty++;
+// buffer 实际占用的内存：各行的 chars/render/hl/chunk/wrap，行数组、行索引和
+// 软换行前缀和。要遍历所有行，只在打开、切换 buffer 和加载完成时调用
+size_t editor_buffer_mem(const struct EditorConfig *b) {
+    if (b->evicted) {
+        return 0;
+    }
+    size_t mem = editor_alloc_size(b->erow) + editor_alloc_size(b->lidx.offsets);
+    for (int j = 0; j < b->row_num; j++) {
+        mem += editor_row_mem(&b->erow[j]);
+    }
+    const struct fenwick *f = &b->wrap_lines;
+    mem += editor_alloc_size(f->blocks) + editor_alloc_size(f->sums) +
+           editor_alloc_size(f->counts);
+    for (int j = 0; j < f->nblocks; j++) {
+        mem += editor_alloc_size(f->blocks[j]);
+    }
+    return mem;
 }
 
-void editor_row_appen_string(Erow *row, char *s, size_t len) {
-    row->chars = realloc(row->chars, row->size + len + 1);
-    memcpy(&row->chars[row->size], s, len);
-    row->size += len;
-    row->chars[row->size] = '\0';
-    editor_update_row(row);
-    E.dirty++;
+// 只有内容与磁盘一致的 buffer 才能丢掉各行，之后从文件原样重建
+int editor_buffer_evictable(const struct EditorConfig *b) {
+    return !b->evicted && !b->dirty && !b->loading && !b->disk_changed && !b->readonly &&
+           b->disk_known && b->filename != NULL && b->row_num > 0;
 }
 
-void editor_insert_char(int c) {
-    if (E.cursor_y == E.row_num) {
-        editor_insert_row(E.row_num, "", 0);
+// 释放各行；行索引与文件状态保留，切回来时据此重建
+void editor_buffer_evict(struct EditorConfig *b) {
+    for (int j = 0; j < b->row_num; j++) {
+        editor_free_row(&b->erow[j]);
     }
-    editor_row_insert_char(&E.erow[E.cursor_y], E.cursor_x, c);
-    E.cursor_x++;
+    free(b->erow);
+    b->erow = NULL;
+    b->row_num = b->row_cap = 0;
+    fenwick_free(&b->wrap_lines);
+    b->wrap_stale = 1;
+    b->hl_dirty_from = b->hl_dirty_to = 0;
+    b->evicted = 1;
 }
 
-void editor_insert_new_line(void) {
-    if (E.cursor_x == 0)
-    {
-        editor_insert_row(E.cursor_y, "", 0);
-    }else
-    {
-        Erow *row = &E.erow[E.cursor_y];
-        if (row->size - 1 > E.cursor_x)
-        {
-            editor_insert_row(E.cursor_y + 1, &row->chars[E.cursor_x], row->size - E.cursor_x);
-            row = &E.erow[E.cursor_y];
-            row->size = E.cursor_x;
-            row->chars[row->size] = '\0';
-            editor_update_row(row);
-        }else {
-            E.cursor_x = 0;
-            editor_insert_row(E.cursor_y + 1, "", 0);
+// 总占用超出预算时，从最久没用过的 buffer 开始淘汰，淘汰后让分配器把空闲
+// 内存还给系统，进程 RSS 因此停在预算附近
+void editor_buffer_trim(void) {
+    size_t total = 0;
+    int evicted = 0;
+    for (int i = 0; i < buffer_num; i++) {
+        total += editor_buffer_mem(editor_buffer_at(i));
+    }
+    while (total > mem_budget) {
+        int victim = -1;
+        for (int i = 0; i < buffer_num; i++) {
+            if (i != buffer_cur && editor_buffer_evictable(&buffers[i]) &&
+                (victim == -1 || buffers[i].used < buffers[victim].used)) {
+                victim = i;
+            }
+        }
+        if (victim == -1) {
+            break;
         }
+        total -= editor_buffer_mem(&buffers[victim]);
+        editor_buffer_evict(&buffers[victim]);
+        evicted = 1;
     }
-
-    E.cursor_y++;
-    E.dirty++;
-
-}
-
-void editor_row_del_char(Erow *row, int at) {
-    if (at < 0 || at >= row->size) {
-        return;
+    if (evicted) {
+        malloc_trim(0);
     }
-    memmove(&row->chars[at], &row->chars[at + 1], row->size - at);
-    row->size--;
-    editor_update_row(row);
-    E.dirty++;
 }
 
-void editor_del_char(void) {
-    if (E.cursor_y == E.row_num) {
+// 换入被淘汰的 buffer：文件没变时整个读入，按保留的行索引直接重建各行，
+// 省掉建行索引；否则整个重新加载。两种都与文件大小成正比
+void editor_buffer_restore(void) {
+    E.evicted = 0;
+    struct stat st;
+    int fd = open(E.filename, O_RDONLY);
+    if (fd == -1 || fstat(fd, &st) == -1 || !editor_disk_unchanged(&st)) {
+        if (fd != -1)
+            close(fd);
+        editor_reload();
         return;
     }
-    if (E.cursor_x == 0 && E.cursor_y == 0)
-    {
+    size_t len;
+    const char *err;
+    char *buf = editor_read_file(fd, st.st_size, &len, &err);
+    close(fd);
+    if (err != NULL || len != E.lidx.len) {
+        free(buf);
+        E.readonly = err != NULL; // 重新读入也失败时保持只读
+        editor_reload();
         return;
     }
-
-    Erow *row = &E.erow[E.cursor_y];
-    if (E.cursor_x > 0) {
-        editor_row_del_char(row, E.cursor_x - 1);
-        E.cursor_x--;
-    } else
-    {
-        E.cursor_x = E.erow[E.cursor_y - 1].size;
-        editor_row_appen_string(&E.erow[E.cursor_y-1], row->chars, row->size);
-        editor_del_row(E.cursor_y);
-        E.cursor_y--;
-    }
+    editor_insert_lines(0, buf, E.lidx.offsets, E.lidx.lines);
+    free(buf);
+    E.dirty = 0;
+    E.first_dirty = INT_MAX;
 }
 
-char *editor_rows_to_string(int *buflen) {
-    int tolen = 0;
-    int j;
-    for (j = 0; j < E.row_num; j++) {
-        tolen += E.erow[j].size + 1;
-    }
-    *buflen = tolen;
-    char *buf = malloc(tolen * sizeof(char));
-    char *p = buf;
-    for (j = 0; j < E.row_num; j++) {
-        memcpy(p, E.erow[j].chars, E.erow[j].size);
-        p += E.erow[j].size;
-        *p = '\n';
-        p++;
+void editor_buffer_switch(int n) {
+    editor_buffer_swap(n);
+    E.used = ++buffer_tick;
+    if (E.evicted) {
+        editor_buffer_restore();
     }
-
-    return buf;
+    editor_buffer_trim();
 }
 
-void editor_open(const char *filename) {
-    FILE *fp = fopen(filename, "r");
-    if (!fp)
-        die("fopen");
-
-    free(E.filename);
-    E.filename = strdup(filename);
-
-    editor_select_syntax_highlight();
-
-    char *line = NULL;
-    size_t line_cap = 0;
-    ssize_t line_len;
-    while ((line_len = getline(&line, &line_cap, fp)) != -1) {
-        while (line_len > 0 &&
-               (line[line_len - 1] == '\n' || line[line_len - 1] == '\r')) {
-            line_len--;
+// 在新 buffer 中打开文件，已经打开的直接切过去；文件不存在时新建
+void editor_buffer_open(const char *filename) {
+    for (int i = 0; i < buffer_num; i++) {
+        const char *name = editor_buffer_at(i)->filename;
+        if (name != NULL && strcmp(name, filename) == 0) {
+            editor_buffer_switch(i);
+            return;
         }
-        if (line_len > 0)
-            editor_insert_row(E.row_num, line, line_len);
     }
-    if (line != NULL) free(line);
-    fclose(fp);
-    E.dirty = 0;
-}
+    int exists = access(filename, F_OK) == 0;
+    if (exists && access(filename, R_OK) == -1) {
+        editor_set_status_message("Can't open %s: %s", filename,
+                                  strerror(errno));
+        return;
+    }
 
-void editor_save(void) {
-    if (E.filename == NULL) {
-        E.filename = editor_prompt("Save as: %s", NULL);
-        if (E.filename == NULL)
-        {
-            editor_set_status_message("Save aborted");
-            return;
+    // 启动时没有打开文件的空 buffer 直接复用
+    if (E.filename != NULL || E.dirty || E.row_num > 0) {
+        if (buffer_num == buffer_cap) {
+            buffer_cap *= 2;
+            buffers = realloc(buffers, sizeof(struct EditorConfig) * buffer_cap);
         }
+        buffers[buffer_cur] = E;
+        buffer_cur = buffer_num++;
+        editor_init_buffer();
+    }
+    if (exists) {
+        editor_open(filename);
+    } else {
+        E.filename = strdup(filename);
         editor_select_syntax_highlight();
+    }
+    editor_buffer_trim();
+}
 
+void editor_buffer_next(int step) {
+    if (buffer_num > 1) {
+        editor_buffer_switch((buffer_cur + step + buffer_num) % buffer_num);
     }
+    editor_set_status_message("[%d/%d] %s", buffer_cur + 1, buffer_num,
+                              E.filename ? E.filename : "[No Name]");
+}
 
-    int len;
-    char *buf = editor_rows_to_string(&len);
-    if (buf == NULL) {
-        editor_set_status_message("Empty content");
+void editor_buffer_prompt_open(void) {
+    char *filename = editor_prompt("Open: %s", NULL);
+    if (filename == NULL) {
         return;
     }
-    int fd = open(E.filename, O_RDWR | O_CREAT, 0644);
-    if (fd != -1) {
-        if (ftruncate(fd, len) != -1) {
-            if (write(fd, buf, len) != -1) {
-                close(fd);
-                free(buf);
-                E.dirty = 0;
-                editor_set_status_message("%d bytes written to disk", len);
-                return;
-            }
+    editor_buffer_open(filename);
+    free(filename);
+}
+
+// 任一 buffer 有未保存的修改
+int editor_any_dirty(void) {
+    for (int i = 0; i < buffer_num; i++) {
+        if (editor_buffer_at(i)->dirty) {
+            return 1;
         }
-        close(fd);
     }
-    free(buf);
-    editor_set_status_message("Can't save! I/O error: %s", strerror(errno));
+    return 0;
 }
 
 void editor_find_callback(char * query, int key) {
@@ -711,10 +2538,13 @@ void editor_find_callback(char * query, int key) {
     static int direction = 1;
 
     static int saved_hl_line = -1;
-    static char * saved_hl = NULL;
+    static int saved_hl_rx = 0;
+    static int saved_hl_len = 0;
+    static unsigned char * saved_hl = NULL;
     if (saved_hl && saved_hl_line != -1)
     {
-        memcpy(E.erow[saved_hl_line].hl, saved_hl, E.erow[saved_hl_line].rsize);
+        editor_row_copy_hl(&E.erow[saved_hl_line], saved_hl_rx, saved_hl_len,
+                           saved_hl, 1);
         free(saved_hl);
         saved_hl_line = -1;
         saved_hl = NULL;
@@ -756,18 +2586,25 @@ void editor_find_callback(char * query, int key) {
         }
 
         Erow *row = &E.erow[current];
-        char *match = strstr(row->render, query);
-        if (match)
+        int match = editor_row_find(row, query);
+        if (match != -1)
         {
             last_match = current;
             E.cursor_y = current;
-            E.cursor_x = editor_row_cx_to_rx(row, match - row->render);
+            E.cursor_x = editor_row_rx_to_cx(row, match);
             E.rowoff = E.row_num;
+            E.voff = LONG_MAX;
 
+            // 只保存匹配区间的高亮，超长行不必整行拷贝
             saved_hl_line = current;
-            saved_hl = malloc(row->rsize);
-            memcpy(saved_hl, row->hl, row->rsize);
-            memset(&row->hl[match - row->render], HL_MATCH, strlen(query));
+            saved_hl_rx = match;
+            saved_hl_len = strlen(query);
+            saved_hl = malloc(saved_hl_len);
+            editor_row_copy_hl(row, match, saved_hl_len, saved_hl, 0);
+            unsigned char *mark = malloc(saved_hl_len);
+            memset(mark, HL_MATCH, saved_hl_len);
+            editor_row_copy_hl(row, match, saved_hl_len, mark, 1);
+            free(mark);
             break;
         }
     }
@@ -793,11 +2630,69 @@ void editor_find(void){
 
 }
 
+void editor_goto_line(void) {
+    char *input = editor_prompt("Go to line: %s (ESC to cancel)", NULL);
+    if (input == NULL) {
+        return;
+    }
+    long line = strtol(input, NULL, 10);
+    free(input);
+
+    if (line < 1)
+        line = 1;
+    if (line > E.row_num)
+        editor_load_until(line);
+    if (line > E.row_num)
+        line = E.row_num;
+    E.cursor_y = line > 0 ? line - 1 : 0;
+    E.cursor_x = 0;
+    // 目标行放在屏幕中间
+    E.rowoff = E.cursor_y - E.screen_rows / 2;
+    if (E.rowoff < 0)
+        E.rowoff = 0;
+    if (E.wrap) {
+        editor_wrap_sync();
+        E.voff = fenwick_prefix(&E.wrap_lines, E.cursor_y) - E.screen_rows / 2;
+        if (E.voff < 0)
+            E.voff = 0;
+    }
+}
+
+// 软换行模式：通过每行屏幕行数的前缀和把光标映射到屏幕行，O(log n)
+void editor_scroll_wrapped(void) {
+    editor_wrap_sync();
+    long cy = fenwick_prefix(&E.wrap_lines, E.cursor_y);
+    E.wrap_cx = 0;
+    if (E.cursor_y < E.row_num) {
+        Erow *row = &E.erow[E.cursor_y];
+        int sub = editor_wrap_line_at(row, E.render_cursor_x);
+        cy += sub;
+        E.wrap_cx = E.render_cursor_x - row->wrap[sub];
+        if (E.wrap_cx >= E.screen_cols)
+            E.wrap_cx = E.screen_cols - 1;
+    }
+
+    if (cy < E.voff) {
+        E.voff = cy;
+    }
+    if (cy >= E.voff + E.screen_rows - 1) {
+        E.voff = cy - E.screen_rows + 2;
+    }
+    E.wrap_cy = cy - E.voff;
+    long before;
+    E.rowoff = fenwick_find(&E.wrap_lines, E.voff, &before);
+    E.coloff = 0;
+}
+
 void editor_scroll(void) {
     E.render_cursor_x = 0;
     if (E.cursor_y < E.row_num) {
         E.render_cursor_x =
-            editor_row_cx_to_rx(&E.erow[E.cursor_y], E.cursor_x);
+            editor_row_cx_to_col(&E.erow[E.cursor_y], E.cursor_x);
+    }
+    if (E.wrap) {
+        editor_scroll_wrapped();
+        return;
     }
 
     if (E.cursor_y < E.rowoff) {
@@ -814,10 +2709,98 @@ void editor_scroll(void) {
     }
 }
 
+// 输出一段带高亮的 render，同色的连续字符合并为一次 append
+void editor_draw_span(struct abuf *ab, const char *c, const unsigned char *hl,
+                      int len, int *current_color) {
+    int run = 0;
+    for (int j = 0; j < len; j++)
+    {
+        int color = hl[j] == HL_NORMAL ? -1 : editor_syntax_to_color(hl[j]);
+        if (color != *current_color)
+        {
+            abuf_append(ab, &c[run], j - run);
+            run = j;
+            *current_color = color;
+            if (color == -1)
+            {
+                abuf_append(ab, "\x1b[39m", 5);
+            } else {
+                char buf[16];
+                int clen = snprintf(buf, sizeof(buf), "\x1b[%dm", color);
+                abuf_append(ab, buf, clen);
+            }
+        }
+    }
+    abuf_append(ab, &c[run], len - run);
+}
+
+// 输出 render 中显示列 [from, from + cols) 的部分，返回实际输出的列数；
+// 跨过左边界的宽字符用空格补齐，放不下的宽字符留到窗口外
+int editor_draw_cols(struct abuf *ab, const char *render,
+                     const unsigned char *hl, int rsize, int ascii, int from,
+                     int cols, int *current_color) {
+    if (ascii) {
+        int n = rsize - from;
+        if (n > cols)
+            n = cols;
+        if (n <= 0)
+            return 0;
+        editor_draw_span(ab, &render[from], &hl[from], n, current_color);
+        return n;
+    }
+
+    int w;
+    int drawn = 0;
+    int b = utf8_prefix(render, rsize, from, &w);
+    if (w < from && b < rsize) {
+        unsigned cp;
+        b += utf8_decode(&render[b], rsize - b, &cp);
+        for (int pad = w + utf8_char_width(cp) - from; pad > 0 && drawn < cols;
+             pad--, drawn++) {
+            abuf_append(ab, " ", 1);
+        }
+    }
+    int n = utf8_prefix(&render[b], rsize - b, cols - drawn, &w);
+    editor_draw_span(ab, &render[b], &hl[b], n, current_color);
+    return drawn + w;
+}
+
+// 输出 row 从显示列 from 开始的 cols 列
+void editor_draw_row(struct abuf *ab, Erow *row, int from, int cols) {
+    int current_color = -1;
+    if (row->chunks && from < row->cols) {
+        // 只访问与可见窗口 [from, from + cols) 相交的 chunk
+        int col = from;
+        int end = from + cols;
+        for (int k = editor_row_chunk_at_col(row, col);
+             k < row->nchunks && col < end; k++) {
+            Echunk *ch = &row->chunks[k];
+            int avail = ch->cstart + ch->cols - col;
+            if (avail <= 0)
+                continue;
+            int drawn = editor_draw_cols(ab, ch->render, ch->hl, ch->rsize,
+                                         ch->ascii, col - ch->cstart,
+                                         end - col, &current_color);
+            col += drawn;
+            if (drawn < avail)
+                break;
+        }
+    } else if (from < row->cols) {
+        editor_draw_cols(ab, row->render, row->hl, row->rsize, row->ascii,
+                         from, cols, &current_color);
+    }
+}
+
 void editor_draw_rows(struct abuf *ab) {
+    int filerow = E.rowoff;
+    int sub = 0; // 软换行模式下 filerow 的第几个屏幕行
+    if (E.wrap) {
+        long before;
+        filerow = fenwick_find(&E.wrap_lines, E.voff, &before);
+        sub = E.voff - before;
+    }
     for (int y = 0; y < E.screen_rows - 1; y++) {
         // write(STDOUT_FILENO, "~\r\n", 3);
-        int filerow = y + E.rowoff;
         if (filerow >= E.row_num) {
             if (E.row_num == 0 && y == E.screen_rows / 3) {
                 char welcome[80];
@@ -837,36 +2820,18 @@ void editor_draw_rows(struct abuf *ab) {
                 abuf_append(ab, "~", 1);
             }
         } else {
-            int len = E.erow[filerow].rsize - E.coloff;
-            if (len < 0) {
-                len = 0;
-            }
-
-            if (len > E.screen_cols)
-                len = E.screen_cols;
-            char *c = &E.erow[filerow].render[E.coloff];
-            unsigned char *hl = &E.erow[filerow].hl[E.coloff];
-            int current_color = -1;
-            int j;
-            for ( j = 0; j < len; j++)
-            {
-                if (hl[j] == HL_NORMAL)
-                {
-                    if (current_color != -1)
-                    {
-                        abuf_append(ab, "\x1b[39m", 5);
-                    }
-                } else {
-                    int color = editor_syntax_to_color(hl[j]);
-                    if (color != current_color)
-                    {
-                        current_color = color;
-                        char buf[16];
-                        int clen = snprintf(buf, sizeof(buf), "\x1b[%dm", color);
-                        abuf_append(ab, buf, clen);
-                    }
+            Erow *row = &E.erow[filerow];
+            if (E.wrap) {
+                int from = row->wrap[sub];
+                int to = sub + 1 < row->nwrap ? row->wrap[sub + 1] : row->cols;
+                editor_draw_row(ab, row, from, to - from);
+                if (++sub >= row->nwrap) {
+                    filerow++;
+                    sub = 0;
                 }
-                abuf_append(ab, &c[j], 1);
+            } else {
+                editor_draw_row(ab, row, E.coloff, E.screen_cols);
+                filerow++;
             }
             abuf_append(ab, "\x1b[39m", 5);
 
@@ -883,9 +2848,25 @@ void editor_draw_status_bar(struct abuf *ab) {
     abuf_append(ab, "\x1b[1;4;7m", 8);
     char status[E.screen_cols], rstatus[80];
 
-    int len = snprintf(status, sizeof(status), "%.20s - %d lines %s",
-                       E.filename ? E.filename : "[No Name]", E.row_num,
+    char name[48]; // "[%d/%d] " 最长 26 字节，加 20 字节文件名和结尾的 0
+    if (buffer_num > 1) {
+        snprintf(name, sizeof(name), "[%d/%d] %.20s", buffer_cur + 1,
+                 buffer_num, E.filename ? E.filename : "[No Name]");
+    } else {
+        snprintf(name, sizeof(name), "%.20s",
+                 E.filename ? E.filename : "[No Name]");
+    }
+
+    int len;
+    if (E.loading) {
+        len = snprintf(status, sizeof(status), "%s - %d lines (loading %d%%) %s",
+                       name, E.row_num,
+                       editor_load_percent(), E.dirty ? "(modified)" : "");
+    } else {
+        len = snprintf(status, sizeof(status), "%s - %d lines%s %s",
+                       name, E.row_num, E.readonly ? " (read-only)" : "",
                        E.dirty ? "(modified)" : "");
+    }
     int rlen = snprintf(rstatus, sizeof(rstatus), "%s | %d/%d", E.syntax ? E.syntax->filetype:"no ft", E.cursor_x + 1,
                         E.cursor_y + 1);
 
@@ -939,8 +2920,12 @@ void editor_refresh_screen(void) {
     char buf[32];
     // snprintf(buf, sizeof(buf), "\x1b[%d;%dH", E.cursor_y + 1,
     // E.render_cursor_x + 1);
-    snprintf(buf, sizeof(buf), "\x1b[%d;%dH", (E.cursor_y - E.rowoff) + 1,
-             (E.render_cursor_x - E.coloff) + 1);
+    if (E.wrap) {
+        snprintf(buf, sizeof(buf), "\x1b[%d;%dH", E.wrap_cy + 1, E.wrap_cx + 1);
+    } else {
+        snprintf(buf, sizeof(buf), "\x1b[%d;%dH", (E.cursor_y - E.rowoff) + 1,
+                 (E.render_cursor_x - E.coloff) + 1);
+    }
     abuf_append(&ab, buf, strlen(buf));
     abuf_append(&ab, "\x1b[?25h", 6);
 
@@ -957,24 +2942,86 @@ void editor_set_status_message(const char *fmt, ...) {
     E.statusmsg_time = time(NULL);
 }
 
-void init_editor(void) {
+void handle_sigwinch(int sig) {
+    (void)sig;
+    winch_pending = 1;
+}
+
+// 把 E 中属于单个 buffer 的状态设为空 buffer
+void editor_init_buffer(void) {
     E.cursor_x = 0;
     E.cursor_y = 0;
     E.render_cursor_x = 0;
     E.row_num = 0;
+    E.row_cap = 0;
     E.rowoff = 0;
     E.coloff = 0;
+    E.wrap = 0;
+    E.voff = 0;
+    E.wrap_cy = E.wrap_cx = 0;
+    E.wrap_stale = 1;
+    E.wrap_lines = (struct fenwick)FENWICK_INIT;
     E.erow = NULL;
+    E.lidx = (struct lineidx)LINEIDX_INIT;
+    E.loading = 0;
+    E.load_fd = -1;
+    E.load_row = 0;
+    E.load_bytes = E.load_total = 0;
     E.dirty = 0;
+    E.first_dirty = INT_MAX;
+    E.disk_known = 0;
+    E.disk_crlf = 0;
+    E.disk_changed = 0;
+    E.follow = 0;
+    E.gzip = 0;
+    E.evicted = 0;
+    E.readonly = 0;
+    E.used = ++buffer_tick;
+    E.watch_wd = -1;
     E.filename = NULL;
+    E.syntax = NULL;
+    E.hl_dirty_from = E.hl_dirty_to = 0;
+}
+
+void init_editor(void) {
+    editor_init_buffer();
+    E.watch_fd = watch_open();
     E.statusmsg[0] = '\0';
     E.statusmsg_time = 0;
-    E.syntax = NULL;
+    E.hl_seq = 0;
+    E.hl_fd = hlworker_start();
+
+    buffer_cap = 4;
+    buffers = malloc(sizeof(struct EditorConfig) * buffer_cap);
+    buffer_num = 1;
+    buffer_cur = 0;
+    const char *budget = getenv("KILO_MEM_BUDGET");
+    mem_budget = (size_t)(budget ? atol(budget) : KILO_MEM_BUDGET) << 20;
+
+    if (get_window_size(&E.screen_rows, &E.screen_cols) == -1) {
+        die("get_window_Size");
+    }
+    E.screen_rows -= 1;
+
+    // 不设置 SA_RESTART，让 poll 被 SIGWINCH 打断
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handle_sigwinch;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGWINCH, &sa, NULL);
+}
 
+void editor_handle_resize(void) {
+    winch_pending = 0;
     if (get_window_size(&E.screen_rows, &E.screen_cols) == -1) {
         die("get_window_Size");
     }
     E.screen_rows -= 1;
+    // 宽度变化后各行的换行缓存自然失效，重建时重新计算
+    E.wrap_stale = 1;
+    for (int i = 0; i < buffer_num; i++) {
+        buffers[i].wrap_stale = 1;
+    }
 }
 
 char * editor_prompt(char *prompt, void (*callback)(char *, int)){
@@ -1054,7 +3101,7 @@ void editor_move_cursor(int key) {
         break;
     case ARROW_LEFT:
         if (E.cursor_x > 0) {
-            E.cursor_x--;
+            E.cursor_x = editor_row_char_start(row, E.cursor_x - 1);
         } else if (E.cursor_y > 0) {
             E.cursor_y--;
             E.cursor_x = E.erow[E.cursor_y].size;
@@ -1063,7 +3110,7 @@ void editor_move_cursor(int key) {
         break;
     case ARROW_RIGHT:
         if (row && E.cursor_x < row->size) {
-            E.cursor_x++;
+            E.cursor_x = editor_row_char_next(row, E.cursor_x);
         } else if (row && E.cursor_y < E.row_num && E.cursor_x == row->size) {
             E.cursor_y++;
             E.cursor_x = 0;
@@ -1076,6 +3123,9 @@ void editor_move_cursor(int key) {
     if (E.cursor_x > rowlen) {
         E.cursor_x = rowlen;
     }
+    if (row) {
+        E.cursor_x = editor_row_char_start(row, E.cursor_x);
+    }
     debug("E: row_num: %d, row_off: %d, colol_off: %d, screen_rows:%d, "
           "screen_cols: %d, render_cursor_x: %d, cursor_x: %d, cursor_y: %d",
           E.row_num, E.rowoff, E.coloff, E.screen_rows, E.screen_cols,
@@ -1084,6 +3134,7 @@ void editor_move_cursor(int key) {
 
 void editor_process_key_press(void) {
     static int quit_times = KILO_QUIT_TIMES;
+    static int reload_times = 1;
 
     int c = editor_read_key();
 
@@ -1092,7 +3143,7 @@ void editor_process_key_press(void) {
         editor_insert_new_line();
         break;
     case CTRL_KEY('q'): {
-        if (E.dirty && quit_times > 0) {
+        if (editor_any_dirty() && quit_times > 0) {
             editor_set_status_message("WARNING!!! File has unsaved changes. "
                                       "Press Ctrl-Q %d more times to quit.",
                                       quit_times);
@@ -1111,6 +3162,33 @@ void editor_process_key_press(void) {
     case CTRL_KEY('f'):
         editor_find();
         break;
+    case CTRL_KEY('g'):
+        editor_goto_line();
+        break;
+    case CTRL_KEY('w'):
+        editor_toggle_wrap();
+        break;
+    case CTRL_KEY('r'):
+        if (E.dirty && reload_times > 0) {
+            editor_set_status_message("WARNING!!! File has unsaved changes. "
+                                      "Press Ctrl-R again to discard them.");
+            reload_times--;
+            return;
+        }
+        editor_reload();
+        break;
+    case CTRL_KEY('t'):
+        editor_toggle_follow();
+        break;
+    case CTRL_KEY('o'):
+        editor_buffer_prompt_open();
+        break;
+    case CTRL_KEY('n'):
+        editor_buffer_next(1);
+        break;
+    case CTRL_KEY('p'):
+        editor_buffer_next(-1);
+        break;
     case ARROW_UP:
         editor_move_cursor(c);
         break;
@@ -1167,6 +3245,7 @@ void editor_process_key_press(void) {
         break;
     }
     quit_times = KILO_QUIT_TIMES;
+    reload_times = 1;
 }
 
 int main(int argc, char const *argv[]) {
@@ -1175,8 +3254,14 @@ int main(int argc, char const *argv[]) {
     if (argc >= 2) {
         editor_open(argv[1]);
     }
+    for (int i = 2; i < argc; i++) {
+        editor_buffer_open(argv[i]);
+    }
+    if (buffer_num > 1) {
+        editor_buffer_switch(0);
+    }
 
-    editor_set_status_message("HELP: Ctrl-S = save | Ctrl-Q = quit | Ctrl-F = find");
+    editor_set_status_message("HELP: Ctrl-S = save | Ctrl-Q = quit | Ctrl-F = find | Ctrl-G = goto | Ctrl-W = wrap | Ctrl-T = follow | Ctrl-O/N/P = open/next/prev");
 
     while (1) {
         editor_refresh_screen();
@@ -0,0 +1,28 @@
+#ifndef KWHASH_H
+#define KWHASH_H
+
+// 关键字完美哈希表，由 gen_keywords 在构建时生成，kilo 与生成器共用同一个哈希函数
+
+struct kwentry {
+    const char *word;
+    unsigned char len;
+    unsigned char type; // 1: 关键字, 2: 类型名
+};
+
+struct kwtable {
+    const struct kwentry *slots;
+    unsigned mask; // 槽数 - 1，槽数为 2 的幂
+    unsigned seed;
+    int min_len, max_len;
+};
+
+static inline unsigned kw_hash(unsigned seed, const char *s, int len) {
+    unsigned h = 2166136261u ^ seed;
+    for (int i = 0; i < len; i++) {
+        h ^= (unsigned char)s[i];
+        h *= 16777619u;
+    }
+    return h ^ (h >> 15);
+}
+
+#endif
@@ -0,0 +1,156 @@
+#include "lineidx.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define LINEIDX_MAX_THREADS 16
+#define LINEIDX_MIN_PART (4 * 1024 * 1024) // 小于该大小不值得开线程
+
+struct lineidx_part {
+    const char *buf;
+    size_t from, to;
+    size_t *out; // 为 NULL 时只计数
+    size_t count;
+};
+
+// 扫描 [from, to) 中的换行符，out 非 NULL 时记录下一行的起始偏移
+static size_t lineidx_scan(const char *buf, size_t from, size_t to,
+                           size_t *out) {
+    size_t n = 0;
+    size_t i = from;
+#if defined(__SSE2__)
+    const __m128i nl = _mm_set1_epi8('\n');
+    for (; i + 16 <= to; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(buf + i));
+        unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+        if (out == NULL) {
+            n += __builtin_popcount(mask);
+            continue;
+        }
+        while (mask) {
+            out[n++] = i + __builtin_ctz(mask) + 1;
+            mask &= mask - 1;
+        }
+    }
+#endif
+    for (; i < to; i++) {
+        if (buf[i] == '\n') {
+            if (out)
+                out[n] = i + 1;
+            n++;
+        }
+    }
+    return n;
+}
+
+static void *lineidx_worker(void *arg) {
+    struct lineidx_part *p = arg;
+    p->count = lineidx_scan(p->buf, p->from, p->to, p->out);
+    return NULL;
+}
+
+// 每段启动一个线程（第 0 段在当前线程执行）
+static void lineidx_run(struct lineidx_part *parts, int nparts) {
+    pthread_t tids[LINEIDX_MAX_THREADS];
+    int started[LINEIDX_MAX_THREADS] = {0};
+    for (int j = 1; j < nparts; j++) {
+        started[j] =
+            pthread_create(&tids[j], NULL, lineidx_worker, &parts[j]) == 0;
+        if (!started[j])
+            lineidx_worker(&parts[j]);
+    }
+    lineidx_worker(&parts[0]);
+    for (int j = 1; j < nparts; j++) {
+        if (started[j])
+            pthread_join(tids[j], NULL);
+    }
+}
+
+int lineidx_build(struct lineidx *idx, const char *buf, size_t len) {
+    struct lineidx_part parts[LINEIDX_MAX_THREADS];
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    int nparts = len / LINEIDX_MIN_PART;
+    if (nparts > ncpu)
+        nparts = ncpu;
+    if (nparts > LINEIDX_MAX_THREADS)
+        nparts = LINEIDX_MAX_THREADS;
+    if (nparts < 1)
+        nparts = 1;
+
+    for (int j = 0; j < nparts; j++) {
+        parts[j].buf = buf;
+        parts[j].from = len / nparts * j;
+        parts[j].to = (j == nparts - 1) ? len : len / nparts * (j + 1);
+        parts[j].out = NULL;
+    }
+
+    // 第一遍并行计数，算出每段结果在 offsets 中的位置
+    lineidx_run(parts, nparts);
+    size_t newlines = 0;
+    for (int j = 0; j < nparts; j++) {
+        newlines += parts[j].count;
+    }
+
+    size_t *offsets = malloc(sizeof(size_t) * (newlines + 2));
+    if (offsets == NULL) {
+        return -1;
+    }
+
+    // 第二遍并行写入
+    size_t pos = 1;
+    for (int j = 0; j < nparts; j++) {
+        parts[j].out = &offsets[pos];
+        pos += parts[j].count;
+    }
+    lineidx_run(parts, nparts);
+
+    offsets[0] = 0;
+    idx->lines = newlines;
+    if (len > 0 && buf[len - 1] != '\n') {
+        // 最后一行没有换行符
+        idx->lines++;
+        offsets[idx->lines] = len;
+    }
+    idx->offsets = offsets;
+    idx->len = len;
+    idx->cap = newlines + 2;
+    return 0;
+}
+
+// 追加另一段索引的 lines 行，offsets 为相对 base 的偏移（共 lines + 1 项）
+int lineidx_append(struct lineidx *idx, const size_t *offsets, size_t lines,
+                   size_t base) {
+    if (idx->lines + lines + 1 > idx->cap) {
+        size_t cap = idx->cap ? idx->cap : 1024;
+        while (cap < idx->lines + lines + 1) {
+            cap *= 2;
+        }
+        size_t *grown = realloc(idx->offsets, sizeof(size_t) * cap);
+        if (grown == NULL) {
+            return -1;
+        }
+        idx->offsets = grown;
+        idx->cap = cap;
+    }
+    if (idx->lines == 0) {
+        idx->offsets[0] = base + offsets[0];
+    }
+    for (size_t i = 1; i <= lines; i++) {
+        idx->offsets[idx->lines + i] = base + offsets[i];
+    }
+    idx->lines += lines;
+    idx->len = idx->offsets[idx->lines];
+    return 0;
+}
+
+void lineidx_free(struct lineidx *idx) {
+    free(idx->offsets);
+    idx->offsets = NULL;
+    idx->lines = 0;
+    idx->len = 0;
+    idx->cap = 0;
+}
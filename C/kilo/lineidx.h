@@ -0,0 +1,24 @@
+#ifndef LINEIDX_H
+#define LINEIDX_H
+
+#include <stddef.h>
+
+// 行偏移索引：offsets[i] 为第 i 行的起始偏移，offsets[lines] == len
+struct lineidx {
+    size_t *offsets;
+    size_t lines;
+    size_t len;
+    size_t cap;
+};
+
+#define LINEIDX_INIT                                                           \
+    { NULL, 0, 0, 0 }
+
+int lineidx_build(struct lineidx *idx, const char *buf, size_t len);
+
+int lineidx_append(struct lineidx *idx, const size_t *offsets, size_t lines,
+                   size_t base);
+
+void lineidx_free(struct lineidx *idx);
+
+#endif
@@ -0,0 +1,241 @@
+#define _GNU_SOURCE
+#include "loader.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "gzio.h"
+#include "lineidx.h"
+
+#define LOADER_FIRST_CHUNK (64 * 1024)
+#define LOADER_CHUNK (1024 * 1024)
+#define LOADER_MAX_QUEUED 16
+
+static pthread_mutex_t load_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t load_cond = PTHREAD_COND_INITIALIZER;
+static struct load_batch *load_head = NULL, *load_tail = NULL;
+static int load_queued = 0;
+static int load_pipe[2] = {-1, -1};
+static pthread_t load_tid;
+static int load_started = 0;
+static int load_fd = -1;
+static size_t load_len = 0;
+static size_t load_pos = 0; // 普通文件已读到的位置
+static const char *load_error = NULL;
+static gzFile load_gz = NULL; // gzip 文件边解压边加载，load_len 为压缩后的大小
+
+static void loader_push(struct load_batch *batch) {
+    pthread_mutex_lock(&load_lock);
+    while (load_queued >= LOADER_MAX_QUEUED) {
+        pthread_cond_wait(&load_cond, &load_lock);
+    }
+    if (load_tail)
+        load_tail->next = batch;
+    else
+        load_head = batch;
+    load_tail = batch;
+    load_queued++;
+    pthread_mutex_unlock(&load_lock);
+    write(load_pipe[1], "", 1);
+}
+
+// 读满 n 字节，只在文件结束或出错时返回较少的字节数，出错时把错误信息记在
+// load_error。gzip 数据被截断时 zlib 先交出已解压的部分，错误只记在状态里，
+// 所以每次都要查 gzerror。普通文件最多读到打开时的长度，之后追加的内容由
+// 文件监视读入
+static ssize_t loader_read(char *buf, size_t n) {
+    if (load_gz) {
+        int got = gzread(load_gz, buf, n);
+        int errnum;
+        const char *msg = gzerror(load_gz, &errnum);
+        if (got < 0 || errnum != Z_OK) {
+            load_error = msg;
+        }
+        return got;
+    }
+    if (n > load_len - load_pos) {
+        n = load_len - load_pos;
+    }
+    size_t got = 0;
+    while (got < n) {
+        ssize_t r = read(load_fd, buf + got, n - got);
+        if (r == -1 && errno == EINTR) {
+            continue;
+        }
+        if (r == -1) {
+            load_error = strerror(errno);
+            return -1;
+        }
+        if (r == 0) {
+            break; // 文件被截短
+        }
+        got += r;
+    }
+    load_pos += got;
+    return got;
+}
+
+// 每次读入一块，接在上一块剩下的半行后面；只把完整的行交出去，
+// 批次持有自己的数据。文件结束时最后一行没有换行也一并交出。
+// 不用 mmap：加载期间文件可能被别的进程截短，访问映射会收到 SIGBUS
+static void *loader_main(void *arg) {
+    (void)arg;
+    size_t chunk = LOADER_FIRST_CHUNK; // 首批尽量小，首屏越快越好
+    size_t base = 0;  // buf[0] 在文件（gzip 为解压后内容）中的偏移
+    size_t carry = 0; // buf 开头属于上一块的半行
+    char *buf = malloc(carry + chunk);
+    int done = 0;
+    while (buf != NULL && !done) {
+        ssize_t got = loader_read(buf + carry, chunk);
+        done = got < (ssize_t)chunk; // 读完或出错都结束
+        size_t len = carry + (got > 0 ? got : 0);
+        size_t end = len;
+        if (!done) {
+            char *nl = memrchr(buf, '\n', len);
+            end = nl ? (size_t)(nl - buf) + 1 : 0;
+        }
+        chunk = LOADER_CHUNK;
+        if (end == 0 && !done) {
+            // 一行还没读完，扩大缓冲区接着读，超长行整行放进同一批
+            char *grown = realloc(buf, len + chunk);
+            if (grown == NULL) {
+                break;
+            }
+            buf = grown;
+            carry = len;
+            continue;
+        }
+
+        struct load_batch *batch = calloc(1, sizeof(*batch));
+        struct lineidx idx = LINEIDX_INIT;
+        if (batch == NULL || lineidx_build(&idx, buf, end) == -1) {
+            free(batch);
+            break;
+        }
+        carry = len - end;
+        char *next = done ? NULL : malloc(carry + chunk);
+        if (next != NULL) {
+            memcpy(next, buf + end, carry);
+        }
+        batch->data = buf;
+        batch->own = buf;
+        batch->offsets = idx.offsets;
+        batch->count = idx.lines;
+        batch->file_offset = base;
+        batch->loaded = load_gz ? (size_t)gzoffset(load_gz) : load_pos;
+        batch->total = load_len;
+        if (load_error != NULL) {
+            batch->error = strdup(load_error);
+        }
+        done = done || next == NULL;
+        batch->done = done;
+        loader_push(batch); // 之后 batch 归 UI 线程
+        if (done) {
+            return NULL;
+        }
+        base += end;
+        buf = next;
+    }
+    // 内存不足时以空批次结束加载
+    free(buf);
+    struct load_batch *batch = calloc(1, sizeof(*batch));
+    if (batch != NULL) {
+        batch->file_offset = base;
+        batch->total = load_len;
+        batch->done = 1;
+        loader_push(batch);
+    }
+    return NULL;
+}
+
+// 启动后台加载，返回供 poll 的通知 fd，失败返回 -1
+int loader_start(const char *filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1 || st.st_size == 0) {
+        close(fd);
+        return -1;
+    }
+    load_len = st.st_size;
+    load_error = NULL;
+    if (gzio_detect(fd)) {
+        load_gz = gzdopen(fd, "rb");
+        if (load_gz == NULL) {
+            close(fd);
+            return -1;
+        }
+        gzbuffer(load_gz, LOADER_CHUNK);
+    } else {
+        load_fd = fd;
+        load_pos = 0;
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+
+    if (pipe(load_pipe) == -1) {
+        loader_close();
+        return -1;
+    }
+    fcntl(load_pipe[0], F_SETFL, O_NONBLOCK);
+    load_started = pthread_create(&load_tid, NULL, loader_main, NULL) == 0;
+    if (!load_started) {
+        loader_close();
+        return -1;
+    }
+    return load_pipe[0];
+}
+
+// 每取走一批读掉一个通知字节，队列不空时 fd 保持可读
+struct load_batch *loader_take(void) {
+    char c;
+    if (read(load_pipe[0], &c, 1) != 1) {
+        return NULL;
+    }
+    pthread_mutex_lock(&load_lock);
+    struct load_batch *batch = load_head;
+    if (batch) {
+        load_head = batch->next;
+        if (load_head == NULL)
+            load_tail = NULL;
+        load_queued--;
+        pthread_cond_signal(&load_cond);
+    }
+    pthread_mutex_unlock(&load_lock);
+    return batch;
+}
+
+void load_batch_free(struct load_batch *batch) {
+    free(batch->own);
+    free(batch->offsets);
+    free(batch->error);
+    free(batch);
+}
+
+// 最后一批处理完之后调用
+void loader_close(void) {
+    if (load_started) {
+        pthread_join(load_tid, NULL);
+        load_started = 0;
+    }
+    if (load_fd != -1) {
+        close(load_fd);
+        load_fd = -1;
+    }
+    if (load_gz) {
+        gzclose(load_gz);
+        load_gz = NULL;
+    }
+    for (int j = 0; j < 2; j++) {
+        if (load_pipe[j] != -1) {
+            close(load_pipe[j]);
+            load_pipe[j] = -1;
+        }
+    }
+}
@@ -0,0 +1,30 @@
+#ifndef LOADER_H
+#define LOADER_H
+
+#include <stddef.h>
+
+// 后台流式加载：loader 线程按块读入文件，把完整的行打包成批次交给 UI 线程；
+// gzip 文件边解压边加载
+
+struct load_batch {
+    const char *data;    // data + offsets[i] 为第 i 行起始（含换行符）
+    char *own;           // 批次自己持有的数据，释放批次时一起释放
+    size_t *offsets;     // count + 1 项
+    size_t count;
+    size_t file_offset;  // data[0] 在文件（gzip 为解压后内容）中的偏移
+    size_t loaded;       // 本批之后已扫描到的位置（gzip 为压缩数据的位置）
+    size_t total;
+    int done;
+    char *error;         // 非 NULL 时加载因读错误提前结束（gzip 数据损坏等）
+    struct load_batch *next;
+};
+
+int loader_start(const char *filename);
+
+struct load_batch *loader_take(void);
+
+void load_batch_free(struct load_batch *batch);
+
+void loader_close(void);
+
+#endif
@@ -0,0 +1,231 @@
+#include "syntax.h"
+#include <ctype.h>
+#include <string.h>
+
+#include "keywords.h"
+
+char *C_HL_EXTENSIONS[] = {".c", ".h", ".cpp", ".hpp", ".cc", ".cxx", NULL};
+char *PY_HL_EXTENSIONS[] = {".py", NULL};
+char *GO_HL_EXTENSIONS[] = {".go", NULL};
+char *JSON_HL_EXTENSIONS[] = {".json", NULL};
+char *YAML_HL_EXTENSIONS[] = {".yaml", ".yml", NULL};
+char *SH_HL_EXTENSIONS[] = {".sh", ".bash", ".zsh", ".bashrc", NULL};
+
+// 新增语言：在这里加一项，关键字写进 keywords.txt
+EditorSyntax HLDB[] = {
+    {"c", C_HL_EXTENSIONS, &kw_c, "//", "/*", "*/", "\"'",
+     HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS},
+    {"python", PY_HL_EXTENSIONS, &kw_python, "#", NULL, NULL, "\"'",
+     HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS},
+    {"go", GO_HL_EXTENSIONS, &kw_go, "//", "/*", "*/", "\"'`",
+     HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS},
+    {"json", JSON_HL_EXTENSIONS, &kw_json, NULL, NULL, NULL, "\"",
+     HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS},
+    {"yaml", YAML_HL_EXTENSIONS, &kw_yaml, "#", NULL, NULL, "\"'",
+     HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS},
+    {"shell", SH_HL_EXTENSIONS, &kw_shell, "#", NULL, NULL, "\"'`",
+     HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS},
+};
+
+#define HLDB_ENTRIES (sizeof(HLDB) / sizeof(HLDB[0]))
+
+EditorSyntax *syntax_select(const char *filename) {
+    if (filename == NULL) {
+        return NULL;
+    }
+
+    const char *ext = strrchr(filename, '.');
+    size_t ext_len = ext ? strlen(ext) : 0;
+    // 压缩文件按 .gz 前面的扩展名匹配
+    if (ext && strcmp(ext, ".gz") == 0) {
+        const char *gz = ext;
+        ext = NULL;
+        for (const char *p = filename; p < gz; p++) {
+            if (*p == '.')
+                ext = p;
+        }
+        ext_len = ext ? (size_t)(gz - ext) : 0;
+    }
+
+    for (unsigned int j = 0; j < HLDB_ENTRIES; j++) {
+        EditorSyntax *s = &HLDB[j];
+        for (unsigned int i = 0; s->file_match[i]; i++) {
+            int is_ext = (s->file_match[i][0] == '.');
+            if ((is_ext && ext && strlen(s->file_match[i]) == ext_len &&
+                 !strncmp(ext, s->file_match[i], ext_len)) ||
+                (!is_ext && strstr(filename, s->file_match[i]))) {
+                return s;
+            }
+        }
+    }
+    return NULL;
+}
+
+// 分隔符查表，避免每个字符都做一次 strchr
+static const unsigned char SEPARATORS[256] = {
+    ['\0'] = 1, [' '] = 1, ['\t'] = 1, ['\n'] = 1, ['\v'] = 1, ['\f'] = 1,
+    ['\r'] = 1, [','] = 1, ['.'] = 1,  ['('] = 1,  [')'] = 1,  ['+'] = 1,
+    ['-'] = 1,  ['/'] = 1, ['\\'] = 1, ['*'] = 1,  ['='] = 1,  ['~'] = 1,
+    ['%'] = 1,  ['<'] = 1, ['>'] = 1,  ['['] = 1,  [']'] = 1,  [';'] = 1,
+    ['{'] = 1,  ['}'] = 1, [':'] = 1,  ['!'] = 1,  ['&'] = 1,  ['|'] = 1,
+    ['^'] = 1,  ['?'] = 1, ['"'] = 1,  ['\''] = 1, ['`'] = 1,  ['#'] = 1,
+    ['@'] = 1,  ['$'] = 1,
+};
+
+int is_separator(int c) {
+    return SEPARATORS[(unsigned char)c];
+}
+
+// 完美哈希查找，一次哈希 + 一次比较，返回 0（非关键字）/1/2
+static int keyword_lookup(const struct kwtable *t, const char *s, int len) {
+    if (len < t->min_len || len > t->max_len) {
+        return 0;
+    }
+    const struct kwentry *e = &t->slots[kw_hash(t->seed, s, len) & t->mask];
+    return (e->len == len && memcmp(e->word, s, len) == 0) ? e->type : 0;
+}
+
+// 先比较首字符，绝大多数位置在这里就被排除
+static inline int starts_with(const char *s, int len, const char *prefix,
+                              int prefix_len) {
+    return prefix_len && s[0] == prefix[0] && len >= prefix_len &&
+           !memcmp(s, prefix, prefix_len);
+}
+
+// 对一段 render 做高亮，st 携带跨段（chunk、行）的状态；
+// 跨 chunk 边界的关键字和注释标记不做识别
+void syntax_highlight(const EditorSyntax *syn, const char *render,
+                      unsigned char *hl, int len, HlState *st) {
+    memset(hl, HL_NORMAL, len);
+
+    if (syn == NULL)
+    {
+        return;
+    }
+
+    const char *scs = syn->singleline_comment_start;
+    const char *mcs = syn->multiline_comment_start;
+    const char *mce = syn->multiline_comment_end;
+    int scs_len = scs ? strlen(scs) : 0;
+    int mcs_len = mcs ? strlen(mcs) : 0;
+    int mce_len = mce ? strlen(mce) : 0;
+
+    if (st->in_line_comment) {
+        memset(hl, HL_COMMENT, len);
+        return;
+    }
+
+    int i = 0;
+    while (i < len)
+    {
+        char c = render[i];
+        unsigned char prev_hl = (i > 0) ? hl[i-1] : st->prev_hl;
+
+        if (st->escaped)
+        {
+            // 上一个 chunk 以转义符结尾
+            hl[i] = HL_STRING;
+            st->escaped = 0;
+            i++;
+            continue;
+        }
+
+        if (!st->in_string && !st->in_comment &&
+            starts_with(&render[i], len - i, scs, scs_len))
+        {
+            memset(&hl[i], HL_COMMENT, len - i);
+            st->in_line_comment = 1;
+            break;
+        }
+
+        if (mcs_len && mce_len && !st->in_string)
+        {
+            if (st->in_comment) {
+                hl[i] = HL_MLCOMMENT;
+                if (starts_with(&render[i], len - i, mce, mce_len)) {
+                    memset(&hl[i], HL_MLCOMMENT, mce_len);
+                    i += mce_len;
+                    st->in_comment = 0;
+                    st->prev_sep = 1;
+                } else {
+                    i++;
+                }
+                continue;
+            } else if (starts_with(&render[i], len - i, mcs, mcs_len)) {
+                memset(&hl[i], HL_MLCOMMENT, mcs_len);
+                i += mcs_len;
+                st->in_comment = 1;
+                continue;
+            }
+        }
+
+        if (syn->flags & HL_HIGHLIGHT_STRINGS)
+        {
+            if (st->in_string) {
+                hl[i] = HL_STRING;
+                if (c == '\\') {
+                    if (i + 1 < len) {
+                        hl[i + 1] = HL_STRING;
+                        i += 2;
+                    } else {
+                        st->escaped = 1;
+                        i++;
+                    }
+                    continue;
+                }
+                if (c == st->in_string) st->in_string = 0;
+                i++;
+                st->prev_sep = 1;
+                continue;
+            } else if ((c == '"' || c == '\'' || c == '`') &&
+                       strchr(syn->quotes, c)) {
+                st->in_string = c;
+                hl[i] = HL_STRING;
+                i++;
+                continue;
+            }
+        }
+
+        if (syn->flags & HL_HIGHLIGHT_NUMBERS)
+        {
+            if ((isdigit((unsigned char)c) &&
+                 (st->prev_sep || prev_hl == HL_NUMBER)) ||
+                (c == '.' && prev_hl == HL_NUMBER))
+            {
+                hl[i] = HL_NUMBER;
+                i++;
+                st->prev_sep = 0;
+                continue;
+            }
+        }
+
+        if (st->prev_sep && !is_separator(c))
+        {
+            // 整个标识符一次性处理，不是关键字也直接跳过
+            int n = 1;
+            while (i + n < len && !is_separator(render[i + n])) {
+                n++;
+            }
+            int kw = syn->keywords ? keyword_lookup(syn->keywords, &render[i], n) : 0;
+            if (kw) {
+                memset(&hl[i], kw == 2 ? HL_KEYWORD2 : HL_KEYWORD1, n);
+            }
+            i += n;
+            st->prev_sep = 0;
+            continue;
+        }
+
+        st->prev_sep = is_separator(c);
+        i++;
+    }
+    if (len > 0) {
+        st->prev_hl = hl[len - 1];
+    }
+}
+
+int hl_state_equal(const HlState *a, const HlState *b) {
+    return a->in_string == b->in_string && a->escaped == b->escaped &&
+           a->in_comment == b->in_comment &&
+           a->in_line_comment == b->in_line_comment &&
+           a->prev_sep == b->prev_sep && a->prev_hl == b->prev_hl;
+}
@@ -0,0 +1,52 @@
+#ifndef SYNTAX_H
+#define SYNTAX_H
+
+#include "kwhash.h"
+
+enum EditorHighlight {
+    HL_NORMAL = 0,
+    HL_COMMENT,
+    HL_MLCOMMENT,
+    HL_KEYWORD1,
+    HL_KEYWORD2,
+    HL_STRING,
+    HL_NUMBER,
+    HL_MATCH,
+};
+
+#define HL_HIGHLIGHT_NUMBERS (1<<0)
+#define HL_HIGHLIGHT_STRINGS (1<<1)
+
+typedef struct _editorSyntax
+{
+    char * filetype;
+    char **file_match;
+    const struct kwtable *keywords;
+    char *singleline_comment_start;
+    char *multiline_comment_start;
+    char *multiline_comment_end;
+    char *quotes; // 字符串引号，取值范围为 "'`
+    int flags;
+} EditorSyntax;
+
+// 高亮状态，在 chunk 之间（以及多行注释在行之间）延续
+typedef struct _hlState {
+    int in_string;
+    int escaped;
+    int in_comment;
+    int in_line_comment;
+    int prev_sep;
+    unsigned char prev_hl;
+} HlState;
+
+#define HL_STATE_INIT                                                          \
+    { 0, 0, 0, 0, 1, HL_NORMAL }
+
+EditorSyntax *syntax_select(const char *filename);
+
+void syntax_highlight(const EditorSyntax *syn, const char *render,
+                      unsigned char *hl, int len, HlState *st);
+
+int hl_state_equal(const HlState *a, const HlState *b);
+
+#endif
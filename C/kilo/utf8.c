@@ -0,0 +1,164 @@
+#include "utf8.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+struct utf8_range {
+    unsigned from, to;
+};
+
+// 组合符号、零宽字符等不占列的区间
+static const struct utf8_range utf8_zero[] = {
+    {0x0300, 0x036F},   {0x0483, 0x0489},   {0x0591, 0x05BD},
+    {0x0610, 0x061A},   {0x064B, 0x065F},   {0x0E31, 0x0E31},
+    {0x0E34, 0x0E3A},   {0x0E47, 0x0E4E},   {0x1AB0, 0x1AFF},
+    {0x1DC0, 0x1DFF},   {0x200B, 0x200F},   {0x2028, 0x202E},
+    {0x2060, 0x2064},   {0x20D0, 0x20FF},   {0x302A, 0x302D},
+    {0x3099, 0x309A},   {0xFE00, 0xFE0F},   {0xFE20, 0xFE2F},
+    {0xFEFF, 0xFEFF},   {0xE0001, 0xE007F}, {0xE0100, 0xE01EF},
+};
+
+// 东亚宽字符与 emoji，占两列
+static const struct utf8_range utf8_wide[] = {
+    {0x1100, 0x115F},   {0x231A, 0x231B},   {0x2329, 0x232A},
+    {0x23E9, 0x23EC},   {0x23F0, 0x23F0},   {0x23F3, 0x23F3},
+    {0x25FD, 0x25FE},   {0x2614, 0x2615},   {0x2648, 0x2653},
+    {0x267F, 0x267F},   {0x2693, 0x2693},   {0x26A1, 0x26A1},
+    {0x26AA, 0x26AB},   {0x26BD, 0x26BE},   {0x26C4, 0x26C5},
+    {0x26CE, 0x26CE},   {0x26D4, 0x26D4},   {0x26EA, 0x26EA},
+    {0x26F2, 0x26F3},   {0x26F5, 0x26F5},   {0x26FA, 0x26FA},
+    {0x26FD, 0x26FD},   {0x2705, 0x2705},   {0x270A, 0x270B},
+    {0x2728, 0x2728},   {0x274C, 0x274C},   {0x274E, 0x274E},
+    {0x2753, 0x2755},   {0x2757, 0x2757},   {0x2795, 0x2797},
+    {0x27B0, 0x27B0},   {0x27BF, 0x27BF},   {0x2B1B, 0x2B1C},
+    {0x2B50, 0x2B50},   {0x2B55, 0x2B55},   {0x2E80, 0x303E},
+    {0x3041, 0x33FF},   {0x3400, 0x4DBF},   {0x4E00, 0x9FFF},
+    {0xA000, 0xA4CF},   {0xA960, 0xA97F},   {0xAC00, 0xD7A3},
+    {0xF900, 0xFAFF},   {0xFE10, 0xFE19},   {0xFE30, 0xFE6F},
+    {0xFF00, 0xFF60},   {0xFFE0, 0xFFE6},   {0x16FE0, 0x16FE4},
+    {0x17000, 0x18AFF}, {0x1B000, 0x1B2FF}, {0x1F004, 0x1F004},
+    {0x1F0CF, 0x1F0CF}, {0x1F18E, 0x1F18E}, {0x1F191, 0x1F19A},
+    {0x1F200, 0x1F202}, {0x1F210, 0x1F23B}, {0x1F240, 0x1F248},
+    {0x1F250, 0x1F251}, {0x1F260, 0x1F265}, {0x1F300, 0x1F320},
+    {0x1F32D, 0x1F335}, {0x1F337, 0x1F37C}, {0x1F37E, 0x1F393},
+    {0x1F3A0, 0x1F3CA}, {0x1F3CF, 0x1F3D3}, {0x1F3E0, 0x1F3F0},
+    {0x1F3F4, 0x1F3F4}, {0x1F3F8, 0x1F43E}, {0x1F440, 0x1F440},
+    {0x1F442, 0x1F4FC}, {0x1F4FF, 0x1F53D}, {0x1F54B, 0x1F54E},
+    {0x1F550, 0x1F567}, {0x1F57A, 0x1F57A}, {0x1F595, 0x1F596},
+    {0x1F5A4, 0x1F5A4}, {0x1F5FB, 0x1F64F}, {0x1F680, 0x1F6C5},
+    {0x1F6CC, 0x1F6CC}, {0x1F6D0, 0x1F6D2}, {0x1F6D5, 0x1F6D7},
+    {0x1F6EB, 0x1F6EC}, {0x1F6F4, 0x1F6FC}, {0x1F7E0, 0x1F7EB},
+    {0x1F90C, 0x1F93A}, {0x1F93C, 0x1F945}, {0x1F947, 0x1F9FF},
+    {0x1FA70, 0x1FAFF}, {0x20000, 0x2FFFD}, {0x30000, 0x3FFFD},
+};
+
+static int utf8_in(const struct utf8_range *t, int n, unsigned cp) {
+    if (cp < t[0].from || cp > t[n - 1].to) {
+        return 0;
+    }
+    int lo = 0, hi = n - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (cp < t[mid].from) {
+            hi = mid - 1;
+        } else if (cp > t[mid].to) {
+            lo = mid + 1;
+        } else {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// 整段都是 ASCII 时返回 1，一次检查 16 字节的最高位
+int utf8_is_ascii(const char *s, size_t len) {
+    size_t i = 0;
+#if defined(__SSE2__)
+    __m128i acc = _mm_setzero_si128();
+    for (; i + 16 <= len; i += 16) {
+        acc = _mm_or_si128(acc, _mm_loadu_si128((const __m128i *)(s + i)));
+    }
+    if (_mm_movemask_epi8(acc)) {
+        return 0;
+    }
+#endif
+    unsigned char bits = 0;
+    for (; i < len; i++) {
+        bits |= (unsigned char)s[i];
+    }
+    return bits < 0x80;
+}
+
+// 解码 s 开头的一个字符，返回其字节数；非法或截断的序列按单字节 U+FFFD 处理
+int utf8_decode(const char *s, int len, unsigned *cp) {
+    const unsigned char *u = (const unsigned char *)s;
+    unsigned c = u[0];
+    int n;
+    if (c < 0x80) {
+        *cp = c;
+        return 1;
+    } else if (c >= 0xC2 && c <= 0xDF) {
+        n = 2;
+        c &= 0x1F;
+    } else if (c >= 0xE0 && c <= 0xEF) {
+        n = 3;
+        c &= 0x0F;
+    } else if (c >= 0xF0 && c <= 0xF4) {
+        n = 4;
+        c &= 0x07;
+    } else {
+        *cp = 0xFFFD;
+        return 1;
+    }
+    if (n > len) {
+        *cp = 0xFFFD;
+        return 1;
+    }
+    for (int j = 1; j < n; j++) {
+        if (!utf8_is_cont(u[j])) {
+            *cp = 0xFFFD;
+            return 1;
+        }
+        c = (c << 6) | (u[j] & 0x3F);
+    }
+    // 过长编码与代理区
+    if ((n == 3 && c < 0x800) || (n == 4 && (c < 0x10000 || c > 0x10FFFF)) ||
+        (c >= 0xD800 && c <= 0xDFFF)) {
+        *cp = 0xFFFD;
+        return 1;
+    }
+    *cp = c;
+    return n;
+}
+
+// 字符占用的终端列数：0、1 或 2
+int utf8_char_width(unsigned cp) {
+    if (cp < 0x300) {
+        return 1;
+    }
+    if (utf8_in(utf8_zero, sizeof(utf8_zero) / sizeof(utf8_zero[0]), cp)) {
+        return 0;
+    }
+    if (utf8_in(utf8_wide, sizeof(utf8_wide) / sizeof(utf8_wide[0]), cp)) {
+        return 2;
+    }
+    return 1;
+}
+
+// 显示宽度不超过 cols 的最长前缀的字节数，width 返回该前缀的实际宽度
+int utf8_prefix(const char *s, int len, int cols, int *width) {
+    int i = 0, col = 0;
+    while (i < len) {
+        unsigned cp;
+        int n = utf8_decode(s + i, len - i, &cp);
+        int w = utf8_char_width(cp);
+        if (col + w > cols) {
+            break;
+        }
+        col += w;
+        i += n;
+    }
+    *width = col;
+    return i;
+}
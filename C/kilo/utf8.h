@@ -0,0 +1,17 @@
+#ifndef UTF8_H
+#define UTF8_H
+
+#include <stddef.h>
+
+// 是否为 UTF-8 多字节序列的后续字节
+#define utf8_is_cont(c) (((unsigned char)(c) & 0xC0) == 0x80)
+
+int utf8_is_ascii(const char *s, size_t len);
+
+int utf8_decode(const char *s, int len, unsigned *cp);
+
+int utf8_char_width(unsigned cp);
+
+int utf8_prefix(const char *s, int len, int cols, int *width);
+
+#endif
@@ -0,0 +1,48 @@
+#include "watch.h"
+#include <errno.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+int watch_open(void) {
+    return inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+}
+
+// 改为监视 filename，返回新的 watch 描述符，失败返回 -1。
+// 先加后删：路径仍是同一个 inode 时内核返回原来的描述符，不会产生多余事件
+int watch_file(int fd, int wd, const char *filename) {
+    if (fd == -1) {
+        return -1;
+    }
+    int nwd = inotify_add_watch(fd, filename,
+                                IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE |
+                                    IN_MOVE_SELF | IN_DELETE_SELF);
+    if (wd != -1 && wd != nwd) {
+        inotify_rm_watch(fd, wd);
+    }
+    return nwd;
+}
+
+// 读完所有排队的事件，合并成 WATCH_* 标志
+int watch_read(int fd) {
+    _Alignas(struct inotify_event) char buf[4096];
+    int flags = 0;
+    while (1) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n <= 0) {
+            if (n == -1 && errno == EINTR)
+                continue;
+            break;
+        }
+        for (char *p = buf; p < buf + n;) {
+            struct inotify_event *ev = (struct inotify_event *)p;
+            if (ev->mask & (IN_MOVE_SELF | IN_DELETE_SELF)) {
+                flags |= WATCH_GONE;
+            }
+            if (!(ev->mask & IN_IGNORED)) {
+                flags |= WATCH_CHANGED;
+            }
+            p += sizeof(struct inotify_event) + ev->len;
+        }
+    }
+    return flags;
+}
@@ -0,0 +1,15 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+// 用 inotify 监视打开的文件，fd 交给编辑器的事件循环 poll
+
+#define WATCH_CHANGED 1 // 内容或属性变了
+#define WATCH_GONE 2    // 文件被删除/改名/替换，需要重新监视路径
+
+int watch_open(void);
+
+int watch_file(int fd, int wd, const char *filename);
+
+int watch_read(int fd);
+
+#endif
@@ -1,133 +1,1475 @@
+#define _GNU_SOURCE // mremap
 #include<stdio.h>
+#include<stdint.h>
 #include<stdlib.h>
 #include<pthread.h>
 #include<string.h>
 #include<unistd.h>
+#include<stdatomic.h>
+#include<errno.h>
+#include<sys/mman.h>
+#include<malloc.h>
+#include<fcntl.h>
+#include<signal.h>
+#include<limits.h>
+#include<execinfo.h>
+#include<sched.h>
+
+#include "memalloc.h"
 
 typedef char ALIGN[16];
 
-pthread_mutex_t global_malloc_lock;
+pthread_mutex_t global_malloc_lock = PTHREAD_MUTEX_INITIALIZER;
 
+// 边界标记：size 为整块大小（含头部），低位存标志。前一块空闲时 prev_size 是它的
+// 大小，相当于前一块的尾部标记，所以已分配的块不需要额外的 footer
 union header
 {
     struct {
+        size_t prev_size;
         size_t size;
-        unsigned is_free;
-        union header * next;
     } s;
     ALIGN stub;
 };
 
 typedef union header header_t;
 
-header_t *head = NULL, *tail = NULL;
+#define BLOCK_FREE 1UL
+#define PREV_FREE 2UL
+#define IS_MMAP 4UL // 单独 mmap 的块，prev_size 为映射起点到块头的距离
+#define ALIGNED_BLOCK 8UL // 线程缓存里 64 字节对齐的块，释放时回到对齐的档
+#define FLAG_MASK 15UL
+#define OWNER_SHIFT 48 // size 的高位记录分配该块的线程堆编号，0 表示共享堆
+#define OWNER_MASK (0xFFUL << OWNER_SHIFT)
+#define SAMPLED (1UL << 63) // 被堆采样记录的块，只在全局锁内设置
+#define PAGES_RELEASED (1UL << 62) // 空闲块：开头 MIN_BLOCK 字节之后的整页都已还给系统
+#define MAX_ALLOC ((size_t)1 << 46)
 
-header_t * get_free_block(size_t size){
-    header_t *curr = head;
-    while (curr)
-    {
-        if (curr->s.is_free && curr->s.size >= size)
+// 空闲块的双向链表指针放在数据区里
+typedef struct free_node {
+    struct free_node *next, *prev;
+} free_node_t;
+
+#define SMALL_STEP 16
+#define SMALL_MAX 256           // 16 字节一档
+#define MEDIUM_MAX (256 * 1024) // 之后每个 2 的幂区间分 4 档
+#define NUM_CLASSES 55          // 小于 MEDIUM_MAX 的档数
+#ifdef MEMALLOC_TLSF
+// 两级分离适配（TLSF）：一级按 2 的幂分组，组内再 16 等分，256 字节以下
+// 16 字节一档。分配和释放都是常数步，没有在链表里找块的过程
+#define TLSF_SL_LOG2 4
+#define TLSF_SL (1 << TLSF_SL_LOG2)
+#define TLSF_SMALL 256
+#define TLSF_FL (46 - 8 + 2) // 第 0 组为 256 以下，第 f 组为 [2^(f+7), 2^(f+8))
+#define NUM_BINS (TLSF_FL * TLSF_SL)
+#define RELEASE_ON_FREE 0 // 释放时不做系统调用，页只在 malloc_trim 时归还
+#else
+#define NUM_BINS (NUM_CLASSES + 64 - 18) // MEDIUM_MAX 起每个 2 的幂一个 bin
+#define RELEASE_ON_FREE 1
+#endif
+#define MIN_BLOCK (sizeof(header_t) + sizeof(free_node_t))
+#define TOP_GROW (64 * 1024)    // 每次向系统多要一些，减少 sbrk 调用
+#define TOP_TRIM (128 * 1024)   // 堆顶空闲超过该值时还给系统
+#define CACHE_MAX 1024          // 不超过该大小的请求走线程缓存
+#define CACHE_CLASSES 24        // size_to_class(CACHE_MAX) + 1
+#define CACHE_BATCH_BYTES (16 * 1024) // 每次批量补充/归还的大致字节数
+#define ALIGNED_CLASSES 16      // 对齐的档：块大小为 64 的倍数，整批起点对齐后每块都对齐
+#define ALIGNED_MAX (ALIGNED_CLASSES * 64 - sizeof(header_t))
+#define CACHE_LISTS (CACHE_CLASSES + ALIGNED_CLASSES)
+#define REMOTE_RECLAIM_MAX 64   // 每次分配最多收回这么多别的线程释放的块，延迟有界
+#define MAX_HEAPS 256           // 同时持有线程堆的线程数上限，多出的线程直接用共享堆
+#define MMAP_THRESHOLD (128 * 1024)        // 超过该大小的请求单独 mmap
+#define MMAP_THRESHOLD_MAX (32 * 1024 * 1024)
+#define HUGE_PAGE (2 * 1024 * 1024)
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#endif
+#define RELEASE_MIN (1024 * 1024) // 不小于该值的空闲块内部的整页已用 madvise 还给系统，
+                                  // 太小的话反复分配释放会不停地缺页
+
+#ifdef MEMALLOC_MADV_FREE
+#define MADV_RELEASE MADV_FREE // 延迟回收，内存紧张时内核才真正拿走
+#define RELEASE_ZEROES 0       // 还没被拿走的页仍是原来的内容
+#else
+#define MADV_RELEASE MADV_DONTNEED
+#define RELEASE_ZEROES 1 // 还掉的页再访问时是新的零页
+#endif
+#define CALLOC_DECOMMIT_MIN (4 * 1024 * 1024) // calloc 清零这么大的脏内存时改为把整页还给系统
+
+static free_node_t *bins[NUM_BINS];
+#ifdef MEMALLOC_TLSF
+static uint64_t fl_bitmap;          // 第 f 位为 1 表示第 f 组里有非空的 bin
+static uint32_t sl_bitmap[TLSF_FL]; // 组内各 bin 是否非空
+#else
+static uint64_t bin_bitmap[2]; // 第 k 位为 1 表示第 k 个 bin 非空
+#endif
+
+// 堆顶尚未切分的区域 [top_ptr, top_end)，top_end 即程序断点。
+// 与堆顶相邻的块释放时并入堆顶，所以空闲块后面总有一个真实的块头
+static char *top_ptr = NULL, *top_end = NULL;
+// [top_zero, top_end) 是从系统新拿到、还没有用过的内存，内容全是零
+static char *top_zero = NULL;
+
+// bin_alloc 最近一次取到的块里已知为零的区间，calloc 在锁内读取
+static char *zero_lo, *zero_hi;
+
+// 与 glibc 相同的动态阈值：释放的 mmap 块比阈值大时把阈值提到它的大小，
+// 反复申请同样大小的缓冲区时不必每次都 mmap/munmap
+static atomic_size_t mmap_threshold = MMAP_THRESHOLD;
+
+// 大页模式，由环境变量 MEMALLOC_HUGEPAGE 选择：thp 用透明大页，hugetlb 先用
+// 预留的大页，没有可用的时退回透明大页。开启后不小于 HUGE_PAGE 的请求总是
+// 单独映射在 2M 对齐的区域里；小块的频繁分配释放仍在普通页的堆上
+enum { HUGE_OFF, HUGE_THP, HUGE_TLB };
+static int huge_mode = HUGE_OFF;
+
+// 统计：共享堆的部分在全局锁内更新；线程堆的计数退出时并入 retired_*
+static size_t heap_bytes, free_bytes, free_blocks;
+static atomic_size_t retired_allocs[CACHE_LISTS], retired_frees[CACHE_LISTS];
+static atomic_size_t shared_allocs, shared_frees, mmap_allocs, mmap_frees, mmap_bytes;
+
+// 线程堆：每档一个单链表，只有拥有者访问，不加锁；缓存里的块对共享堆来说
+// 仍是占用的。别的线程释放的块压进 remote，拥有者下次分配时整串取走。
+// 线程堆放在静态数组里而不是 TLS，线程退出后别的线程仍可安全地压栈
+typedef struct thread_heap {
+    free_node_t *list[CACHE_LISTS]; // 先是普通的档，后面是 64 字节对齐的档
+    unsigned count[CACHE_LISTS];
+    atomic_size_t allocs[CACHE_LISTS], frees[CACHE_LISTS]; // 只有拥有者写
+    free_node_t *backlog; // 已从 remote 取走、还没放回缓存的块，只有拥有者访问
+    _Alignas(64) free_node_t *_Atomic remote;
+    atomic_int alive; // 槽位是否有线程在用，在全局锁下认领
+} thread_heap_t;
+
+static thread_heap_t heaps[MAX_HEAPS]; // 0 号不用
+static __thread int heap_id __attribute__((tls_model("initial-exec"))); // 0 未认领，-1 不用线程堆
+static pthread_key_t heap_key;
+static pthread_once_t heap_once = PTHREAD_ONCE_INIT;
+
+static size_t align16(size_t size) {
+    return (size + 15) & ~(size_t)15;
+}
+
+static size_t block_size(header_t *header) {
+    return header->s.size & ~(FLAG_MASK | OWNER_MASK | SAMPLED | PAGES_RELEASED);
+}
+
+static unsigned block_owner(header_t *header) {
+    return (header->s.size & OWNER_MASK) >> OWNER_SHIFT;
+}
+
+
+static header_t *next_block(header_t *header) {
+    return (header_t *)((char *)header + block_size(header));
+}
+
+static char *page_floor(char *p) {
+    return (char *)((uintptr_t)p & ~(uintptr_t)(sysconf(_SC_PAGESIZE) - 1));
+}
+
+static char *page_ceil(char *p) {
+    uintptr_t page = sysconf(_SC_PAGESIZE);
+    return (char *)(((uintptr_t)p + page - 1) & ~(page - 1));
+}
+
+// 数据区大小所在的档：小块按 16 字节一档，中块把 (2^p, 2^(p+1)] 四等分
+static unsigned size_to_class(size_t size) {
+    if (size <= SMALL_MAX) {
+        return (size + SMALL_STEP - 1) / SMALL_STEP - 1;
+    }
+    unsigned p = 63 - __builtin_clzll(size - 1);
+    unsigned sub = ((size - 1) >> (p - 2)) & 3;
+    return SMALL_MAX / SMALL_STEP + (p - 8) * 4 + sub;
+}
+
+static size_t class_size(unsigned cls) {
+    if (cls < SMALL_MAX / SMALL_STEP) {
+        return (size_t)(cls + 1) * SMALL_STEP;
+    }
+    unsigned p = (cls - SMALL_MAX / SMALL_STEP) / 4 + 8;
+    unsigned sub = (cls - SMALL_MAX / SMALL_STEP) % 4;
+    return ((size_t)1 << p) + ((size_t)(sub + 1) << (p - 2));
+}
+
+// 空闲块放进不超过其大小的最大一档，这样第 k 个 bin 里的块都能满足
+// 向上取整到第 k 档的请求；MEDIUM_MAX 以上按 2 的幂分 bin
+static unsigned free_bin(size_t payload) {
+    if (payload >= MEDIUM_MAX) {
+        return NUM_CLASSES + (63 - __builtin_clzll(payload)) - 18;
+    }
+    unsigned cls = size_to_class(payload);
+    return class_size(cls) == payload ? cls : cls - 1;
+}
+
+static void list_push(free_node_t **list, free_node_t *node) {
+    node->prev = NULL;
+    node->next = *list;
+    if (*list)
+        (*list)->prev = node;
+    *list = node;
+}
+
+static void list_remove(free_node_t **list, free_node_t *node) {
+    if (node->prev)
+        node->prev->next = node->next;
+    else
+        *list = node->next;
+    if (node->next)
+        node->next->prev = node->prev;
+}
+
+#ifdef MEMALLOC_TLSF
+// 空闲块所在的 bin：第 k 个 bin 里的块不小于该档的下界，小于下一档的下界
+static unsigned bin_index(size_t payload) {
+    if (payload < TLSF_SMALL) {
+        return payload / SMALL_STEP;
+    }
+    unsigned p = 63 - __builtin_clzll(payload);
+    return (p - 7) * TLSF_SL + ((payload >> (p - TLSF_SL_LOG2)) & (TLSF_SL - 1));
+}
+
+// 请求向上取整到下一档的下界，从这个 bin 起任取一块都够用
+static unsigned bin_search(size_t payload) {
+    if (payload >= TLSF_SMALL) {
+        payload += ((size_t)1 << (63 - __builtin_clzll(payload) - TLSF_SL_LOG2)) - 1;
+    }
+    return bin_index(payload);
+}
+
+static void bin_set(unsigned bin) {
+    sl_bitmap[bin / TLSF_SL] |= 1U << (bin % TLSF_SL);
+    fl_bitmap |= 1ULL << (bin / TLSF_SL);
+}
+
+static void bin_clear(unsigned bin) {
+    sl_bitmap[bin / TLSF_SL] &= ~(1U << (bin % TLSF_SL));
+    if (sl_bitmap[bin / TLSF_SL] == 0)
+        fl_bitmap &= ~(1ULL << (bin / TLSF_SL));
+}
+
+// 不小于 bin 的第一个非空 bin，先查组内再查更高的组，没有时返回 NUM_BINS
+static unsigned bin_find(unsigned bin) {
+    unsigned fl = bin / TLSF_SL;
+    uint32_t sl_map = sl_bitmap[fl] & (~0U << (bin % TLSF_SL));
+    if (!sl_map) {
+        uint64_t fl_map = fl + 1 < TLSF_FL ? fl_bitmap & (~0ULL << (fl + 1)) : 0;
+        if (!fl_map)
+            return NUM_BINS;
+        fl = __builtin_ctzll(fl_map);
+        sl_map = sl_bitmap[fl];
+    }
+    return fl * TLSF_SL + __builtin_ctz(sl_map);
+}
+#else
+static unsigned bin_index(size_t payload) {
+    return free_bin(payload);
+}
+
+static void bin_set(unsigned bin) {
+    bin_bitmap[bin / 64] |= 1ULL << (bin % 64);
+}
+
+static void bin_clear(unsigned bin) {
+    bin_bitmap[bin / 64] &= ~(1ULL << (bin % 64));
+}
+
+// 不小于 bin 的第一个非空 bin，没有时返回 NUM_BINS
+static unsigned bin_find(unsigned bin) {
+    for (unsigned w = bin / 64; w < 2; w++) {
+        uint64_t avail = bin_bitmap[w];
+        if (w == bin / 64)
+            avail &= ~0ULL << (bin % 64);
+        if (avail)
+            return w * 64 + __builtin_ctzll(avail);
+    }
+    return NUM_BINS;
+}
+#endif
+
+static void bin_push(header_t *header) {
+    unsigned bin = bin_index(block_size(header) - sizeof(header_t));
+    list_push(&bins[bin], (free_node_t *)(header + 1));
+    bin_set(bin);
+    free_bytes += block_size(header);
+    free_blocks++;
+}
+
+static void bin_remove(header_t *header) {
+    unsigned bin = bin_index(block_size(header) - sizeof(header_t));
+    list_remove(&bins[bin], (free_node_t *)(header + 1));
+    if (bins[bin] == NULL)
+        bin_clear(bin);
+    free_bytes -= block_size(header);
+    free_blocks--;
+}
+
+// 标成空闲块：在下一块的头部写入尾部标记，放进对应的 bin
+static void mark_free(header_t *header, size_t size) {
+    header->s.size = size | BLOCK_FREE;
+    header_t *next = next_block(header);
+    next->s.prev_size = size;
+    next->s.size |= PREV_FREE;
+    bin_push(header);
+}
+
+// 占用空闲块的前 size 字节，剩下的部分够大时切出来放回 bin。
+// 块里的页还过时，剩下的部分也还是还过的
+static header_t *take_block(header_t *header, size_t size) {
+    bin_remove(header);
+    size_t total = block_size(header);
+    size_t released = header->s.size & PAGES_RELEASED;
+    if (released && RELEASE_ZEROES) {
+        char *end = (char *)header + (total - size >= MIN_BLOCK ? size : total);
+        zero_lo = page_ceil((char *)header + MIN_BLOCK);
+        zero_hi = page_floor((char *)header + total);
+        if (zero_hi > end)
+            zero_hi = end;
+    }
+    if (total - size >= MIN_BLOCK) {
+        header->s.size = size;
+        mark_free(next_block(header), total - size);
+        next_block(header)->s.size |= released;
+    } else {
+        header->s.size = total;
+        next_block(header)->s.size &= ~PREV_FREE;
+    }
+    return header;
+}
+
+// 保证堆顶至少有 total 字节外加一个块头的空间，不够时向系统扩展；
+// 断点不连续时堆顶会挪到新的位置
+static int top_reserve(size_t total) {
+    if ((size_t)(top_end - top_ptr) < total + sizeof(header_t)) {
+        size_t grow = total + sizeof(header_t);
+        grow = grow < TOP_GROW ? TOP_GROW : align16(grow);
+        char *block = sbrk(grow);
+        if (block == (void *) -1)
         {
-            return curr;
+            return -1;
         }
-        curr = curr->s.next;
+        if (block != top_end) {
+            // 断点被别人移动过：原来剩下的一截写成占用中的隔断，合并不会越过它
+            if (top_ptr != NULL)
+                ((header_t *)top_ptr)->s.size = top_end - top_ptr;
+            top_ptr = block;
+            top_zero = page_ceil(block); // 开头那一页别人可能用过
+        }
+        top_end = block + grow;
+        heap_bytes += grow;
+    }
+    return 0;
+}
 
+// 从堆顶切出 total 字节
+static header_t *top_carve(size_t total) {
+    if (top_reserve(total) == -1) {
+        return NULL;
     }
+    header_t *header = (header_t *)top_ptr;
+    header->s.size = total;
+    zero_lo = (char *)(header + 1) > top_zero ? (char *)(header + 1) : top_zero;
+    zero_hi = top_ptr + total;
+    top_ptr += total;
+    if (top_zero < top_ptr)
+        top_zero = top_ptr;
+    return header;
+}
 
-    return NULL;
+// 断点退回到 top_end 后，它所在的那一页还留着，再长回来时只有之后的页是新的
+static void top_shrunk(void) {
+    if (top_zero > page_ceil(top_end))
+        top_zero = page_ceil(top_end);
 }
 
-void * malloc(size_t size){
-    printf("My Malloc");
-    if (size == 0)
-    {
+// 堆顶空闲过多时收缩程序断点
+static void top_trim(void) {
+    if (top_end - top_ptr > TOP_TRIM && sbrk(0) == top_end) {
+        size_t shrink = (top_end - top_ptr) - TOP_GROW;
+        sbrk(-(intptr_t)shrink);
+        top_end -= shrink;
+        heap_bytes -= shrink;
+        top_shrunk();
+    }
+}
+
+// 把 [lo, hi) 内的整页还给系统，内容作废但地址仍然有效
+static int release_pages(char *lo, char *hi) {
+    uintptr_t page = sysconf(_SC_PAGESIZE);
+    uintptr_t from = ((uintptr_t)lo + page - 1) & ~(page - 1);
+    uintptr_t to = (uintptr_t)hi & ~(page - 1);
+    if (from >= to) {
+        return 0;
+    }
+    madvise((void *)from, to - from, MADV_RELEASE);
+    return 1;
+}
+
+#ifdef MEMALLOC_TLSF
+// 两次位图查找得到 bin，取其头部按需切分
+static header_t *bin_alloc(size_t payload) {
+    payload = align16(payload);
+    unsigned bin = bin_find(bin_search(payload));
+    if (bin < NUM_BINS) {
+        return take_block((header_t *)bins[bin] - 1, payload + sizeof(header_t));
+    }
+    return top_carve(payload + sizeof(header_t));
+}
+#else
+// 中小块向上取整到档，位图里找第一个非空 bin 取其头部即可；
+// 大块先在自己的 bin 里最佳适配，再往上任取一块。取到的块按需切分
+static header_t *bin_alloc(size_t payload) {
+    unsigned bin;
+    if (payload <= MEDIUM_MAX) {
+        bin = size_to_class(payload);
+        payload = class_size(bin);
+    } else {
+        payload = align16(payload);
+        bin = free_bin(payload);
+        free_node_t *best = NULL;
+        for (free_node_t *node = bins[bin]; node; node = node->next) {
+            size_t size = block_size((header_t *)node - 1);
+            if (size - sizeof(header_t) >= payload &&
+                (best == NULL || size < block_size((header_t *)best - 1))) {
+                best = node;
+            }
+        }
+        if (best)
+            return take_block((header_t *)best - 1, payload + sizeof(header_t));
+        bin++;
+    }
+    size_t total = payload + sizeof(header_t);
+    bin = bin_find(bin);
+    if (bin < NUM_BINS) {
+        return take_block((header_t *)bins[bin] - 1, total);
+    }
+    return top_carve(total);
+}
+#endif
+
+// 释放一块（调用者持有锁）：与前后相邻的空闲块或堆顶合并，
+// 前一块靠头部标志和尾部标记 O(1) 找到
+// 合并后的空闲块够大时把其中的脏页还给系统；相邻的空闲块已还过的部分跳过，
+// 只补上交界处的页
+static void heap_free(header_t *header) {
+    size_t size = block_size(header);
+    char *dirty = (char *)header, *dirty_end = (char *)header + size;
+    size_t prev_released = 0, next_released = 0;
+    if (header->s.size & PREV_FREE) {
+        header_t *prev = (header_t *)((char *)header - header->s.prev_size);
+        bin_remove(prev);
+        prev_released = prev->s.size & PAGES_RELEASED;
+        size += block_size(prev);
+        header = prev;
+    }
+    header_t *next = (header_t *)((char *)header + size);
+    if ((char *)next == top_ptr) {
+        top_ptr = (char *)header;
+        if (RELEASE_ON_FREE)
+            top_trim();
+    } else {
+        if (next->s.size & BLOCK_FREE) {
+            bin_remove(next);
+            next_released = next->s.size & PAGES_RELEASED;
+            size += block_size(next);
+        }
+        mark_free(header, size);
+        if (RELEASE_ON_FREE && size >= RELEASE_MIN) {
+            // 块头和链表指针所在的开头要保留
+            char *keep = (char *)header + MIN_BLOCK, *end = (char *)header + size;
+            char *lo = prev_released ? page_floor(dirty) : keep;
+            char *hi = next_released ? page_ceil(dirty_end + MIN_BLOCK) : end;
+            release_pages(lo > keep ? lo : keep, hi < end ? hi : end);
+            header->s.size |= PAGES_RELEASED;
+        }
+    }
+}
+
+// 已分配的块原地改为 total 字节（调用者持有锁）：变大时吞并后面的空闲块
+// 或向堆顶延伸，多出的尾部够大时切下来释放。做不到时返回 0
+static int heap_resize(header_t *header, size_t total) {
+    size_t size = block_size(header);
+    size_t flags = header->s.size & PREV_FREE;
+    header_t *next = next_block(header);
+    if (total > size) {
+        if ((char *)next == top_ptr && top_reserve(total - size) == 0 && (char *)next == top_ptr) {
+            header->s.size = total | flags;
+            top_ptr = (char *)header + total;
+            if (top_zero < top_ptr)
+                top_zero = top_ptr;
+            return 1;
+        }
+        if (!(next->s.size & BLOCK_FREE) || size + block_size(next) < total) {
+            return 0;
+        }
+        bin_remove(next);
+        size += block_size(next);
+        next_block(next)->s.size &= ~PREV_FREE;
+    }
+    if (size - total >= MIN_BLOCK) {
+        header->s.size = total | flags;
+        header_t *tail = next_block(header);
+        tail->s.size = size - total;
+        heap_free(tail);
+    } else {
+        header->s.size = size | flags;
+    }
+    return 1;
+}
+
+// 把块开头的 lead 字节切下来释放，返回剩下的部分（调用者持有锁）
+static header_t *split_front(header_t *header, size_t lead) {
+    header_t *rest = (header_t *)((char *)header + lead);
+    rest->s.size = block_size(header) - lead;
+    header->s.size = lead | (header->s.size & PREV_FREE);
+    heap_free(header);
+    return rest;
+}
+
+__attribute__((constructor)) static void huge_init(void) {
+    const char *mode = getenv("MEMALLOC_HUGEPAGE");
+    if (mode == NULL)
+        return;
+    if (strcmp(mode, "thp") == 0)
+        huge_mode = HUGE_THP;
+    else if (strcmp(mode, "hugetlb") == 0)
+        huge_mode = HUGE_TLB;
+}
+
+// 请求是否单独映射
+static int use_mmap(size_t size) {
+    return size >= atomic_load_explicit(&mmap_threshold, memory_order_relaxed) ||
+           (huge_mode != HUGE_OFF && size >= HUGE_PAGE);
+}
+
+// 映射从 2M 边界开始的 total 字节并要求用透明大页。末尾不满 2M 的部分内核
+// 只会用普通页，不必取整，免得为最后几个字节占掉一整个大页
+static char *huge_map_thp(size_t total) {
+    char *p = mmap(NULL, total + HUGE_PAGE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        return p;
+    }
+    char *start = (char *)(((uintptr_t)p + HUGE_PAGE - 1) & ~(uintptr_t)(HUGE_PAGE - 1));
+    if (start > p) {
+        munmap(p, start - p);
+    }
+    munmap(start + total, p + HUGE_PAGE - start);
+    madvise(start, total, MADV_HUGEPAGE);
+    return start;
+}
+
+// 预留的大页只能整页映射，成功时把 *total 取整为 HUGE_PAGE 的倍数
+static char *huge_map(size_t *total) {
+    if (huge_mode == HUGE_TLB) {
+        size_t rounded = (*total + HUGE_PAGE - 1) & ~(size_t)(HUGE_PAGE - 1);
+        char *p = mmap(NULL, rounded, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_HUGE_2MB, -1, 0);
+        if (p != MAP_FAILED) {
+            *total = rounded;
+            return p;
+        }
+    }
+    return huge_map_thp(*total);
+}
+
+// 大块单独映射，释放时直接 munmap。要求对齐时多映射 align 字节，
+// 块头前面空出的部分记在 prev_size 里。大页模式下够大的块从 2M 边界开始映射
+static void *mmap_alloc(size_t size, size_t align) {
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t extra = align > sizeof(header_t) ? align : 0;
+    size_t total = (size + sizeof(header_t) + extra + page - 1) & ~(page - 1);
+    char *p;
+    if (huge_mode != HUGE_OFF && total >= HUGE_PAGE) {
+        p = huge_map(&total);
+    } else {
+        p = mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    }
+    if (p == MAP_FAILED) {
         return NULL;
     }
-    size_t total_size = size + sizeof(header_t);
-    void * block;
-    header_t *header;
+    size_t offset = extra ? ((-(uintptr_t)p - sizeof(header_t)) & (align - 1)) : 0;
+    header_t *header = (header_t *)(p + offset);
+    header->s.prev_size = offset;
+    header->s.size = (total - offset) | IS_MMAP;
+    atomic_fetch_add_explicit(&mmap_allocs, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&mmap_bytes, total, memory_order_relaxed);
+    return header + 1;
+}
 
+static void mmap_free(header_t *header) {
+    size_t total = block_size(header) + header->s.prev_size;
+    size_t threshold = atomic_load_explicit(&mmap_threshold, memory_order_relaxed);
+    if (total > threshold && total <= MMAP_THRESHOLD_MAX) {
+        atomic_store_explicit(&mmap_threshold, total, memory_order_relaxed);
+    }
+    atomic_fetch_add_explicit(&mmap_frees, 1, memory_order_relaxed);
+    atomic_fetch_sub_explicit(&mmap_bytes, total, memory_order_relaxed);
+    munmap((char *)header - header->s.prev_size, total);
+}
+
+// mmap 块用 mremap 改大小，内核只挪页表不复制数据。大页模式下原地伸缩不了时
+// 先映射一块 2M 对齐的区域，再把页挪过去，免得挪到不对齐的地址上用不了大页。
+// 失败时返回 NULL，原来的块不变
+static void *mmap_realloc(header_t *header, size_t size) {
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t offset = header->s.prev_size;
+    size_t total = block_size(header) + offset;
+    size_t want = (offset + sizeof(header_t) + size + page - 1) & ~(page - 1);
+    int huge = huge_mode != HUGE_OFF && want >= HUGE_PAGE;
+    // 取整到大页：预留大页的映射只能按整页伸缩；透明大页只有整个 2M 都在映射
+    // 里时缺页才会用上，一点点长大的缓冲区不取整就一直是普通页
+    if (huge) {
+        want = (want + HUGE_PAGE - 1) & ~(size_t)(HUGE_PAGE - 1);
+    }
+    if (want == total) {
+        return header + 1;
+    }
+    char *p;
+    if (!huge) {
+        p = mremap((char *)header - offset, total, want, MREMAP_MAYMOVE);
+    } else if ((p = mremap((char *)header - offset, total, want, 0)) == MAP_FAILED) {
+        char *dest = huge_map_thp(want);
+        if (dest == MAP_FAILED) {
+            return NULL;
+        }
+        p = mremap((char *)header - offset, total, want, MREMAP_MAYMOVE | MREMAP_FIXED, dest);
+        if (p == MAP_FAILED) {
+            munmap(dest, want);
+        }
+    }
+    if (p == MAP_FAILED) {
+        return NULL;
+    }
+    if (huge) { // 原来不是大页映射的块长大后也要标记
+        madvise(p, want, MADV_HUGEPAGE);
+    }
+    header = (header_t *)(p + offset);
+    header->s.size = (want - offset) | IS_MMAP;
+    atomic_fetch_add_explicit(&mmap_bytes, want - total, memory_order_relaxed);
+    return header + 1;
+}
+
+// 缓存第 cls 条链表里块的数据区大小
+static size_t cache_size(unsigned cls) {
+    if (cls < CACHE_CLASSES) {
+        return class_size(cls);
+    }
+    return (cls - CACHE_CLASSES + 1) * 64 - sizeof(header_t);
+}
+
+// 每次补充/归还的块数，小档多一些
+static unsigned cache_batch(unsigned cls) {
+    size_t n = CACHE_BATCH_BYTES / cache_size(cls);
+    return n < 4 ? 4 : n > 64 ? 64 : n;
+}
+
+static void cache_flush(thread_heap_t *heap, unsigned cls, unsigned keep) {
     pthread_mutex_lock(&global_malloc_lock);
+    while (heap->count[cls] > keep) {
+        free_node_t *node = heap->list[cls];
+        heap->list[cls] = node->next;
+        heap->count[cls]--;
+        heap_free((header_t *)node - 1);
+    }
+    pthread_mutex_unlock(&global_malloc_lock);
+}
 
-    header = get_free_block(size);
+// 块在线程缓存里应放的链表
+static unsigned cache_class(header_t *header) {
+    if (header->s.size & ALIGNED_BLOCK) {
+        size_t k = block_size(header) / 64;
+        return CACHE_CLASSES + (k < ALIGNED_CLASSES ? k : ALIGNED_CLASSES) - 1;
+    }
+    return free_bin(block_size(header) - sizeof(header_t));
+}
 
-    if (header)
-    {
-        header->s.is_free = 0;
+// 只有拥有者写的计数：relaxed 的读加写，编译出来就是普通的加法
+static void stat_inc(atomic_size_t *counter) {
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + 1,
+                          memory_order_relaxed);
+}
+
+// 放回本线程的缓存，攒多了再成批还给共享堆
+static void cache_push(thread_heap_t *heap, header_t *header, unsigned cls) {
+    free_node_t *node = (free_node_t *)(header + 1);
+    node->next = heap->list[cls];
+    heap->list[cls] = node;
+    if (++heap->count[cls] >= 2 * cache_batch(cls)) {
+        cache_flush(heap, cls, cache_batch(cls));
+    }
+}
+
+// 把一串块直接还给共享堆
+static void remote_release(free_node_t *node) {
+    pthread_mutex_lock(&global_malloc_lock);
+    while (node) {
+        free_node_t *next = node->next;
+        heap_free((header_t *)node - 1);
+        node = next;
+    }
+    pthread_mutex_unlock(&global_malloc_lock);
+}
+
+// 别的线程释放的块用 CAS 压进拥有者的 remote 栈。拥有者总是用 exchange
+// 整串取走而不是逐个弹出，所以压栈一侧不存在 ABA 问题。拥有者若已退出，
+// 压完后自己把整串取走还给共享堆
+static void remote_push(thread_heap_t *heap, header_t *header) {
+    free_node_t *node = (free_node_t *)(header + 1);
+    free_node_t *head = atomic_load_explicit(&heap->remote, memory_order_relaxed);
+    do {
+        node->next = head;
+    } while (!atomic_compare_exchange_weak(&heap->remote, &head, node));
+    if (!atomic_load(&heap->alive)) {
+        remote_release(atomic_exchange(&heap->remote, NULL));
+    }
+}
+
+// 拥有者在分配时收回别的线程释放的块：remote 栈整串取到 backlog，每次最多
+// 放回 max 个，别的线程一次释放很多块时分配的延迟也不会跟着变长
+static void remote_reclaim(thread_heap_t *heap, unsigned max) {
+    if (heap->backlog == NULL) {
+        heap->backlog = atomic_exchange_explicit(&heap->remote, NULL, memory_order_acquire);
+    }
+    free_node_t *node = heap->backlog;
+    for (unsigned i = 0; node && i < max; i++) {
+        free_node_t *next = node->next;
+        cache_push(heap, (header_t *)node - 1, cache_class((header_t *)node - 1));
+        node = next;
+    }
+    heap->backlog = node;
+}
+
+// 线程退出时把缓存和 remote 栈都还给共享堆，让出槽位。先清 alive 再取
+// remote，之后压栈的线程一定能看到 alive 为 0 并自己处理
+static void heap_destroy(void *arg) {
+    thread_heap_t *heap = arg;
+    for (unsigned cls = 0; cls < CACHE_LISTS; cls++) {
+        cache_flush(heap, cls, 0);
+        atomic_fetch_add(&retired_allocs[cls], atomic_exchange(&heap->allocs[cls], 0));
+        atomic_fetch_add(&retired_frees[cls], atomic_exchange(&heap->frees[cls], 0));
+    }
+    heap_id = -1;
+    if (heap->backlog) {
+        remote_release(heap->backlog);
+        heap->backlog = NULL;
+    }
+    atomic_store(&heap->alive, 0);
+    remote_release(atomic_exchange(&heap->remote, NULL));
+}
+
+static void heap_init(void) {
+    pthread_key_create(&heap_key, heap_destroy);
+}
+
+// 第一次使用时认领一个空闲槽位并登记退出回调；没有空位就只用共享堆
+static thread_heap_t *heap_get(void) {
+    if (heap_id == 0) {
+        pthread_once(&heap_once, heap_init);
+        heap_id = -1;
+        pthread_mutex_lock(&global_malloc_lock);
+        for (int i = 1; i < MAX_HEAPS; i++) {
+            if (!atomic_load_explicit(&heaps[i].alive, memory_order_relaxed)) {
+                atomic_store(&heaps[i].alive, 1);
+                heap_id = i;
+                break;
+            }
+        }
         pthread_mutex_unlock(&global_malloc_lock);
-        return (void *)(header + 1);
+        if (heap_id > 0)
+            pthread_setspecific(heap_key, &heaps[heap_id]);
     }
+    return heap_id > 0 ? &heaps[heap_id] : NULL;
+}
 
-    block = sbrk(total_size);
-    if (block == (void *) -1)
-    {
+// 测试用：补充线程缓存时放开全局锁之后调用，默认什么也不做
+#ifndef CACHE_REFILL_HOOK
+#define CACHE_REFILL_HOOK(header)
+#endif
+
+// 一次从共享堆取一整块，切成 batch 个同档的块放进缓存。对齐的档多要一点，
+// 切掉开头使第一块的数据区 64 字节对齐，块大小是 64 的倍数，后面的块自然对齐
+static int cache_refill(thread_heap_t *heap, unsigned cls) {
+    size_t total = cache_size(cls) + sizeof(header_t);
+    unsigned batch = cache_batch(cls);
+    size_t flags = (size_t)heap_id << OWNER_SHIFT;
+    pthread_mutex_lock(&global_malloc_lock);
+    header_t *header;
+    if (cls < CACHE_CLASSES) {
+        header = bin_alloc(total * batch - sizeof(header_t));
+    } else {
+        header = bin_alloc(total * batch + 64 + MIN_BLOCK);
+        if (header) {
+            size_t lead = (-(uintptr_t)header - sizeof(header_t)) & 63;
+            if (lead) {
+                header = split_front(header, lead < MIN_BLOCK ? lead + 64 : lead);
+            }
+        }
+        flags |= ALIGNED_BLOCK;
+    }
+    if (header == NULL) {
         pthread_mutex_unlock(&global_malloc_lock);
+        return -1;
+    }
+    heap_resize(header, total * batch); // 取整多出的部分还回去
+    size_t rest = block_size(header);
+    // 第一块的块头也是前一块的"下一块"，前一块释放时会在锁内改写它的
+    // PREV_FREE 和 prev_size，所以在锁内写，并保留已有的 PREV_FREE
+    header->s.size = (header->s.size & PREV_FREE) | (batch > 1 ? total : rest) | flags;
+    pthread_mutex_unlock(&global_malloc_lock);
+    CACHE_REFILL_HOOK(header);
+    char *p = (char *)header;
+    for (unsigned i = 0; i < batch; i++) {
+        header_t *h = (header_t *)p;
+        // 最后一块带上切不下来的零头
+        if (i > 0)
+            h->s.size = (i + 1 < batch ? total : rest) | flags;
+        free_node_t *node = (free_node_t *)(h + 1);
+        node->next = heap->list[cls];
+        heap->list[cls] = node;
+        p += total;
+        rest -= total;
+    }
+    heap->count[cls] += batch;
+    return 0;
+}
+
+static void *cache_alloc(thread_heap_t *heap, unsigned cls) {
+    if (heap->backlog || atomic_load_explicit(&heap->remote, memory_order_relaxed)) {
+        remote_reclaim(heap, REMOTE_RECLAIM_MAX);
+    }
+    if (heap->list[cls] == NULL && cache_refill(heap, cls) == -1) {
         return NULL;
     }
-    header = block;
-    header->s.size = size;
-    header->s.is_free = 0;
-    header->s.next = NULL;
+    free_node_t *node = heap->list[cls];
+    heap->list[cls] = node->next;
+    heap->count[cls]--;
+    stat_inc(&heap->allocs[cls]);
+    return node;
+}
+
+// 堆采样：环境变量 MEMALLOC_PROFILE 给出输出文件前缀时开启，平均每分配
+// MEMALLOC_SAMPLE 字节（默认 512K）记录一次调用栈。收到 SIGUSR2 或进程退出时
+// 写出 pprof 能读的旧式文本堆剖面，按调用栈汇总仍存活的和累计分配的对象
+#define PROFILE_SAMPLE (512 * 1024)
+#define PROFILE_DEPTH 32
+#define PROFILE_STACKS 16384    // 2 的幂
+#define PROFILE_LIVE (1 << 17)  // 2 的幂
+
+typedef struct profile_stack {
+    uint64_t hash;
+    int depth;
+    void *pc[PROFILE_DEPTH];
+    size_t alloc_objs, alloc_bytes, inuse_objs, inuse_bytes;
+} profile_stack_t;
 
-    if (!head)
+// 采样到的存活对象，按地址开放寻址
+typedef struct profile_live {
+    void *ptr; // NULL 表示空位
+    uint32_t stack;
+    size_t size;
+} profile_live_t;
+
+static size_t profile_period; // 0 表示未开启
+static const char *profile_prefix;
+static profile_stack_t *profile_stacks;
+static profile_live_t *profile_live;
+static size_t profile_nstacks, profile_nlive;
+static int profile_seq;
+// 用自旋标志而不是互斥锁，信号处理函数里只试一次，拿不到就留给持有者写
+static atomic_flag profile_busy = ATOMIC_FLAG_INIT;
+static atomic_int profile_pending;
+
+static __thread long long sample_left __attribute__((tls_model("initial-exec")));
+static __thread uint64_t sample_rng __attribute__((tls_model("initial-exec")));
+static __thread int in_profiler __attribute__((tls_model("initial-exec")));
+
+// 指数分布的采样间隔，使采样是泊松过程，pprof 才能按 heap_v2 的公式还原总量。
+// ln 用位运算加多项式近似，免得依赖 libm
+static long long profile_interval(void) {
+    if (sample_rng == 0)
+        sample_rng = (uintptr_t)&sample_rng * 0x9E3779B97F4A7C15ULL | 1;
+    sample_rng ^= sample_rng << 13;
+    sample_rng ^= sample_rng >> 7;
+    sample_rng ^= sample_rng << 17;
+    double u = ((sample_rng >> 11) + 1) * (1.0 / 9007199254740992.0); // (0, 1]
+    union { double d; uint64_t i; } bits = { u };
+    int e = (int)((bits.i >> 52) & 0x7FF) - 1023;
+    bits.i = (bits.i & ((1ULL << 52) - 1)) | (1023ULL << 52);
+    double m = bits.d - 1; // u = (1 + m) * 2^e
+    double log2u = e + m * (1.4425449 + m * (-0.7181452 + m * 0.2755657));
+    return (long long)(-log2u * 0.6931471805599453 * profile_period) + 1;
+}
+
+static uint64_t profile_hash(void **pc, int depth) {
+    uint64_t h = 14695981039346656037ULL;
+    for (int i = 0; i < depth; i++)
+        h = (h ^ (uintptr_t)pc[i]) * 1099511628211ULL;
+    return h;
+}
+
+static size_t profile_slot(void *ptr) {
+    return ((uintptr_t)ptr >> 4) * 0x9E3779B97F4A7C15ULL >> 40 & (PROFILE_LIVE - 1);
+}
+
+static void profile_write(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n <= 0)
+            return;
+        buf += n;
+        len -= n;
+    }
+}
+
+// 剖面可能在 SIGUSR2 的处理函数里写出，snprintf 在那里不安全。下面几个函数
+// 把字符串、十进制数（不足 width 位补 0）和十六进制地址写到 [p, end)，放不下
+// 的部分截掉，返回写到的位置
+static char *fmt_str(char *p, char *end, const char *s) {
+    while (*s && p < end)
+        *p++ = *s++;
+    return p;
+}
+
+static char *fmt_dec(char *p, char *end, size_t v, int width) {
+    char digits[20];
+    int n = 0;
+    do {
+        digits[n++] = '0' + v % 10;
+        v /= 10;
+    } while (v);
+    while (width-- > n && p < end)
+        *p++ = '0';
+    while (n > 0 && p < end)
+        *p++ = digits[--n];
+    return p;
+}
+
+static char *fmt_hex(char *p, char *end, uintptr_t v) {
+    char digits[16];
+    int n = 0;
+    do {
+        digits[n++] = "0123456789abcdef"[v & 15];
+        v >>= 4;
+    } while (v);
+    p = fmt_str(p, end, "0x");
+    while (n > 0 && p < end)
+        *p++ = digits[--n];
+    return p;
+}
+
+// 一行剖面最长为头部的 5 个 20 位数字加分隔符，或 4 个数字加 PROFILE_DEPTH 个
+// " 0x" 与 16 位十六进制地址
+#define PROFILE_LINE (5 * 20 + 32 + PROFILE_DEPTH * 19 + 1)
+
+// "%zu: %zu [%zu: %zu]"
+static char *fmt_counts(char *p, char *end, size_t a, size_t b, size_t c, size_t d) {
+    p = fmt_dec(p, end, a, 0);
+    p = fmt_str(p, end, ": ");
+    p = fmt_dec(p, end, b, 0);
+    p = fmt_str(p, end, " [");
+    p = fmt_dec(p, end, c, 0);
+    p = fmt_str(p, end, ": ");
+    p = fmt_dec(p, end, d, 0);
+    return fmt_str(p, end, "]");
+}
+
+// 写出一份剖面（调用者持有 profile_busy），末尾附上 /proc/self/maps 供符号化
+static void profile_dump_locked(void) {
+    char path[PATH_MAX], line[PROFILE_LINE];
+    char *end = path + sizeof(path) - 1;
+    char *p = fmt_str(path, end, profile_prefix);
+    p = fmt_str(p, end, ".");
+    p = fmt_dec(p, end, (size_t)getpid(), 0);
+    p = fmt_str(p, end, ".");
+    p = fmt_dec(p, end, (size_t)profile_seq++, 4);
+    p = fmt_str(p, end, ".heap");
+    *p = '\0';
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1)
+        return;
+    size_t inuse_objs = 0, inuse_bytes = 0, alloc_objs = 0, alloc_bytes = 0;
+    for (size_t i = 0; i < PROFILE_STACKS; i++) {
+        inuse_objs += profile_stacks[i].inuse_objs;
+        inuse_bytes += profile_stacks[i].inuse_bytes;
+        alloc_objs += profile_stacks[i].alloc_objs;
+        alloc_bytes += profile_stacks[i].alloc_bytes;
+    }
+    // 留一个字节给行尾的换行
+    end = line + sizeof(line) - 1;
+    p = fmt_str(line, end, "heap profile: ");
+    p = fmt_counts(p, end, inuse_objs, inuse_bytes, alloc_objs, alloc_bytes);
+    p = fmt_str(p, end, " @ heap_v2/");
+    p = fmt_dec(p, end, profile_period, 0);
+    *p++ = '\n';
+    profile_write(fd, line, p - line);
+    for (size_t i = 0; i < PROFILE_STACKS; i++) {
+        profile_stack_t *st = &profile_stacks[i];
+        if (st->alloc_objs == 0)
+            continue;
+        p = fmt_counts(line, end, st->inuse_objs, st->inuse_bytes, st->alloc_objs,
+                       st->alloc_bytes);
+        p = fmt_str(p, end, " @");
+        for (int d = 0; d < st->depth; d++) {
+            p = fmt_str(p, end, " ");
+            p = fmt_hex(p, end, (uintptr_t)st->pc[d]);
+        }
+        *p++ = '\n';
+        profile_write(fd, line, p - line);
+    }
+    profile_write(fd, "\nMAPPED_LIBRARIES:\n", 19);
+    int maps = open("/proc/self/maps", O_RDONLY | O_CLOEXEC);
+    if (maps != -1) {
+        char buf[4096];
+        ssize_t len;
+        while ((len = read(maps, buf, sizeof(buf))) > 0)
+            profile_write(fd, buf, len);
+        close(maps);
+    }
+    close(fd);
+}
+
+static void profile_lock(void) {
+    while (atomic_flag_test_and_set_explicit(&profile_busy, memory_order_acquire))
+        sched_yield();
+}
+
+// 解锁时补写信号到来时没能写出的剖面
+static void profile_unlock(void) {
+    atomic_flag_clear_explicit(&profile_busy, memory_order_release);
+    while (atomic_load(&profile_pending) &&
+           !atomic_flag_test_and_set_explicit(&profile_busy, memory_order_acquire)) {
+        if (atomic_exchange(&profile_pending, 0))
+            profile_dump_locked();
+        atomic_flag_clear_explicit(&profile_busy, memory_order_release);
+    }
+}
+
+static void profile_signal(int sig) {
+    (void)sig;
+    int saved = errno;
+    atomic_store(&profile_pending, 1);
+    if (!atomic_flag_test_and_set_explicit(&profile_busy, memory_order_acquire)) {
+        if (atomic_exchange(&profile_pending, 0))
+            profile_dump_locked();
+        atomic_flag_clear_explicit(&profile_busy, memory_order_release);
+    }
+    errno = saved;
+}
+
+// 采样间隔用完时调用：记录 p 的调用栈，在块头打上 SAMPLED 以便释放时注销
+__attribute__((noinline)) static void profile_sample(void *p, size_t size) {
+    if (profile_period == 0) {
+        sample_left = LLONG_MAX;
+        return;
+    }
+    sample_left = profile_interval();
+    // backtrace 第一次调用时会加载 libgcc，里面的分配不再采样
+    if (p == NULL || in_profiler)
+        return;
+    in_profiler = 1;
+    void *pc[PROFILE_DEPTH + 1];
+    int depth = backtrace(pc, PROFILE_DEPTH + 1) - 1; // 去掉本函数
+    uint64_t hash = profile_hash(pc + 1, depth);
+    profile_lock();
+    size_t i = hash & (PROFILE_STACKS - 1);
+    while (profile_stacks[i].depth != 0 && profile_stacks[i].hash != hash)
+        i = (i + 1) & (PROFILE_STACKS - 1);
+    size_t slot = profile_slot(p);
+    int ok = profile_nlive < PROFILE_LIVE / 2 &&
+             (profile_stacks[i].depth != 0 || profile_nstacks < PROFILE_STACKS / 2);
+    if (ok) {
+        profile_stack_t *st = &profile_stacks[i];
+        if (st->depth == 0) {
+            st->hash = hash;
+            st->depth = depth;
+            memcpy(st->pc, pc + 1, depth * sizeof(void *));
+            profile_nstacks++;
+        }
+        st->alloc_objs++;
+        st->alloc_bytes += size;
+        st->inuse_objs++;
+        st->inuse_bytes += size;
+        while (profile_live[slot].ptr != NULL)
+            slot = (slot + 1) & (PROFILE_LIVE - 1);
+        profile_live[slot] = (profile_live_t){p, (uint32_t)i, size};
+        profile_nlive++;
+    }
+    profile_unlock();
+    if (ok) {
+        // 相邻块释放时会在锁内改写这个块头，所以同样在锁内设置
+        pthread_mutex_lock(&global_malloc_lock);
+        ((header_t *)p - 1)->s.size |= SAMPLED;
+        pthread_mutex_unlock(&global_malloc_lock);
+    }
+    in_profiler = 0;
+}
+
+// 被采样的块释放或改变大小时注销，线性探测表用后移删除，不留墓碑
+static void profile_forget(header_t *header) {
+    void *p = header + 1;
+    profile_lock();
+    size_t slot = profile_slot(p);
+    while (profile_live[slot].ptr != NULL && profile_live[slot].ptr != p)
+        slot = (slot + 1) & (PROFILE_LIVE - 1);
+    if (profile_live[slot].ptr == p) {
+        profile_stack_t *st = &profile_stacks[profile_live[slot].stack];
+        st->inuse_objs--;
+        st->inuse_bytes -= profile_live[slot].size;
+        size_t hole = slot;
+        for (size_t j = (slot + 1) & (PROFILE_LIVE - 1); profile_live[j].ptr != NULL;
+             j = (j + 1) & (PROFILE_LIVE - 1)) {
+            size_t home = profile_slot(profile_live[j].ptr);
+            // home 不在 (hole, j] 之间时可以挪到空位
+            if (((j - home) & (PROFILE_LIVE - 1)) >= ((j - hole) & (PROFILE_LIVE - 1))) {
+                profile_live[hole] = profile_live[j];
+                hole = j;
+            }
+        }
+        profile_live[hole].ptr = NULL;
+        profile_nlive--;
+    }
+    profile_unlock();
+    pthread_mutex_lock(&global_malloc_lock);
+    header->s.size &= ~SAMPLED;
+    pthread_mutex_unlock(&global_malloc_lock);
+}
+
+static inline void *profile_account(void *p, size_t size) {
+    if ((sample_left -= (long long)size) < 0)
+        profile_sample(p, size);
+    return p;
+}
+
+__attribute__((constructor)) static void profile_init(void) {
+    const char *prefix = getenv("MEMALLOC_PROFILE");
+    if (prefix == NULL || *prefix == '\0')
+        return;
+    const char *period = getenv("MEMALLOC_SAMPLE");
+    size_t bytes = PROFILE_SAMPLE;
+    if (period && strtoull(period, NULL, 10) > 0)
+        bytes = strtoull(period, NULL, 10);
+    size_t len = PROFILE_STACKS * sizeof(profile_stack_t) + PROFILE_LIVE * sizeof(profile_live_t);
+    char *mem = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED)
+        return;
+    profile_stacks = (profile_stack_t *)mem;
+    profile_live = (profile_live_t *)(mem + PROFILE_STACKS * sizeof(profile_stack_t));
+    profile_prefix = prefix;
+    void *pc[1];
+    backtrace(pc, 1); // 先加载好 libgcc
+    profile_period = bytes;
+    sample_left = 0;
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = profile_signal;
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGUSR2, &sa, NULL);
+}
+
+__attribute__((destructor)) static void profile_fini(void) {
+    if (profile_period == 0)
+        return;
+    profile_lock();
+    profile_dump_locked();
+    profile_unlock();
+}
+
+// malloc 与 calloc 共用；calloc 不直接调用 malloc，免得编译器把
+// malloc + memset 识别成对 calloc 自身的调用
+static void *heap_alloc(size_t size) {
+    if (size == 0 || size > MAX_ALLOC)
     {
-        head = header;
+        return NULL;
+    }
+    header_t *header;
+
+    thread_heap_t *heap;
+    if (size <= CACHE_MAX && (heap = heap_get()) != NULL) {
+        return cache_alloc(heap, size_to_class(size));
     }
 
-    if(tail){
-        tail->s.next = header;
+    if (use_mmap(size)) {
+        return mmap_alloc(size, 0);
     }
 
-    tail = header;
+    pthread_mutex_lock(&global_malloc_lock);
+    header = bin_alloc(size);
     pthread_mutex_unlock(&global_malloc_lock);
+    atomic_fetch_add_explicit(&shared_allocs, 1, memory_order_relaxed);
 
-    return block;
+    return header ? (void *)(header + 1) : NULL;
+}
+
+void * malloc(size_t size){
+    return profile_account(heap_alloc(size), size);
 }
 
+// 小块按记录的拥有者处理：自己的放回缓存，别人的压进对方的 remote 栈
 void free(void *block) {
-    printf("My free");
-    header_t *header, *tmp;
-    void *program_break;
+    header_t *header;
     if (!block)
     {
         return;
     }
 
-    pthread_mutex_lock(&global_malloc_lock);
     header = (header_t *)block - 1; // 指向 header 起始地址
-
-    program_break = sbrk(0);
-
-    if ((char *)block + header->s.size == program_break)
-    {
-        // 正好是最后一个block
-        if (head == tail)
-        {
-            // 最后一块
-            head = tail = NULL;
-        }else
-        {
-            tmp = head;
-            while (tmp)
-            {
-                if (tmp->s.next == tail)
-                {
-                    tmp->s.next = NULL;
-                    tail = tmp;
-                }
-                tmp = tmp->s.next;
-            }
+    if (header->s.size & SAMPLED) {
+        profile_forget(header);
+    }
+    if (header->s.size & IS_MMAP) {
+        mmap_free(header);
+        return;
+    }
+    size_t payload = block_size(header) - sizeof(header_t);
+    thread_heap_t *heap;
+    if (payload <= CACHE_MAX && (heap = heap_get()) != NULL) {
+        unsigned owner = block_owner(header);
+        unsigned cls = cache_class(header);
+        stat_inc(&heap->frees[cls]);
+        // 块头可能正被相邻块的释放在锁内改写，这里不加锁，所以不改拥有者
+        if (owner != 0 && owner != (unsigned)heap_id) {
+            remote_push(&heaps[owner], header);
+            return;
         }
-        sbrk(0 - header->s.size - sizeof(header_t)); // 释放 header + 实际内存区域
-        pthread_mutex_unlock((&global_malloc_lock));
+        cache_push(heap, header, cls);
         return;
     }
-    header->s.is_free = 1; // 只标记当前块为可用，实际并未释放内存
+
+    pthread_mutex_lock(&global_malloc_lock);
+    heap_free(header);
     pthread_mutex_unlock((&global_malloc_lock));
+    atomic_fetch_add_explicit(&shared_frees, 1, memory_order_relaxed);
+}
+
+// 把本线程缓存的块、堆顶多余的部分和所有空闲块里的整页还给系统，
+// 堆顶至少保留 pad 字节。有内存归还时返回 1
+int malloc_trim(size_t pad) {
+    if (heap_id > 0) {
+        thread_heap_t *heap = &heaps[heap_id];
+        while (heap->backlog || atomic_load(&heap->remote))
+            remote_reclaim(heap, UINT_MAX);
+        for (unsigned cls = 0; cls < CACHE_LISTS; cls++)
+            cache_flush(heap, cls, 0);
+    }
+    int released = 0;
+    pthread_mutex_lock(&global_malloc_lock);
+    size_t keep = align16(pad) + sizeof(header_t);
+    if (top_ptr != NULL && (size_t)(top_end - top_ptr) > keep && sbrk(0) == top_end) {
+        size_t shrink = (top_end - top_ptr - keep) & ~(size_t)(sysconf(_SC_PAGESIZE) - 1);
+        if (shrink > 0 && sbrk(-(intptr_t)shrink) != (void *)-1) {
+            top_end -= shrink;
+            heap_bytes -= shrink;
+            top_shrunk();
+            released = 1;
+        }
+    }
+    for (unsigned bin = 0; bin < NUM_BINS; bin++) {
+        for (free_node_t *node = bins[bin]; node; node = node->next) {
+            header_t *header = (header_t *)node - 1;
+            released |= release_pages((char *)header + MIN_BLOCK, (char *)header + block_size(header));
+            header->s.size |= PAGES_RELEASED;
+        }
+    }
+    pthread_mutex_unlock(&global_malloc_lock);
+    return released;
+}
+
+// 对齐分配的公共部分，align 为 2 的幂。32/64 字节对齐的小块走线程缓存里
+// 对齐的档；其余的多取 align 字节，把开头和结尾多出的部分切下来还回空闲链表
+static void *heap_memalign(size_t align, size_t size) {
+    if (align <= sizeof(header_t)) {
+        return heap_alloc(size);
+    }
+    if (size == 0 || size > MAX_ALLOC || align > MAX_ALLOC) {
+        return NULL;
+    }
+    thread_heap_t *heap;
+    if (align <= 64 && size <= ALIGNED_MAX && (heap = heap_get()) != NULL) {
+        return cache_alloc(heap, CACHE_CLASSES + (size + sizeof(header_t) - 1) / 64);
+    }
+    if (use_mmap(size + align)) {
+        return mmap_alloc(size, align);
+    }
+    pthread_mutex_lock(&global_malloc_lock);
+    header_t *header = bin_alloc(size + align + MIN_BLOCK);
+    if (header) {
+        size_t lead = (-(uintptr_t)header - sizeof(header_t)) & (align - 1);
+        if (lead) {
+            while (lead < MIN_BLOCK)
+                lead += align;
+            header = split_front(header, lead);
+        }
+        heap_resize(header, align16(size) + sizeof(header_t));
+    }
+    pthread_mutex_unlock(&global_malloc_lock);
+    atomic_fetch_add_explicit(&shared_allocs, 1, memory_order_relaxed);
+    return header ? (void *)(header + 1) : NULL;
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size) {
+    if (alignment == 0 || alignment % sizeof(void *) != 0 ||
+        (alignment & (alignment - 1)) != 0) {
+        return EINVAL;
+    }
+    void *block = profile_account(heap_memalign(alignment, size), size);
+    if (block == NULL && size != 0) {
+        return ENOMEM;
+    }
+    *memptr = block;
+    return 0;
+}
+
+// 对齐不是 2 的幂时与 glibc 一样向上取整
+void *memalign(size_t alignment, size_t size) {
+    if (alignment > MAX_ALLOC) {
+        return NULL;
+    }
+    size_t align = 1;
+    while (align < alignment)
+        align <<= 1;
+    return profile_account(heap_memalign(align, size), size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+    return memalign(alignment, size);
+}
+
+void *valloc(size_t size) {
+    return profile_account(heap_memalign(sysconf(_SC_PAGESIZE), size), size);
+}
+
+void *pvalloc(size_t size) {
+    size_t page = sysconf(_SC_PAGESIZE);
+    return profile_account(heap_memalign(page, (size + page - 1) & ~(page - 1)), size);
+}
+
+size_t malloc_usable_size(void *block) {
+    if (block == NULL) {
+        return 0;
+    }
+    return block_size((header_t *)block - 1) - sizeof(header_t);
+}
+
+// 某条缓存链表的分配、释放次数与当前缓存的块数，包括已退出线程的计数
+static void cache_stats(unsigned cls, size_t *allocs, size_t *frees, size_t *cached) {
+    *allocs = atomic_load_explicit(&retired_allocs[cls], memory_order_relaxed);
+    *frees = atomic_load_explicit(&retired_frees[cls], memory_order_relaxed);
+    *cached = 0;
+    for (int i = 1; i < MAX_HEAPS; i++) {
+        if (!atomic_load_explicit(&heaps[i].alive, memory_order_relaxed))
+            continue;
+        *allocs += atomic_load_explicit(&heaps[i].allocs[cls], memory_order_relaxed);
+        *frees += atomic_load_explicit(&heaps[i].frees[cls], memory_order_relaxed);
+        *cached += __atomic_load_n(&heaps[i].count[cls], __ATOMIC_RELAXED);
+    }
+}
+
+// 字段含义与 glibc 相同；smblks/fsmblks 借来表示线程缓存里的块
+struct mallinfo2 mallinfo2(void) {
+    struct mallinfo2 mi;
+    memset(&mi, 0, sizeof(mi));
+    for (unsigned cls = 0; cls < CACHE_LISTS; cls++) {
+        size_t allocs, frees, cached;
+        cache_stats(cls, &allocs, &frees, &cached);
+        mi.smblks += cached;
+        mi.fsmblks += cached * (cache_size(cls) + sizeof(header_t));
+    }
+    pthread_mutex_lock(&global_malloc_lock);
+    mi.arena = heap_bytes;
+    mi.ordblks = free_blocks;
+    mi.keepcost = top_end - top_ptr;
+    mi.fordblks = free_bytes + mi.keepcost;
+    pthread_mutex_unlock(&global_malloc_lock);
+    mi.hblks = atomic_load(&mmap_allocs) - atomic_load(&mmap_frees);
+    mi.hblkhd = atomic_load(&mmap_bytes);
+    mi.uordblks = mi.arena - mi.fordblks - mi.fsmblks;
+    return mi;
+}
+
+// 总量和各档的计数打到 stderr；直接 write，避免 stdio 反过来调用 malloc
+void malloc_stats(void) {
+    char line[256]; // 最长的第一行是 60 来个字符加 7 个至多 20 位的数字
+    struct mallinfo2 mi = mallinfo2();
+    int n = snprintf(line, sizeof(line),
+                     "heap %zu in use %zu free %zu (%zu blocks) top %zu cached %zu (%zu blocks)\n",
+                     mi.arena, mi.uordblks, mi.fordblks, mi.ordblks, mi.keepcost, mi.fsmblks, mi.smblks);
+    write(STDERR_FILENO, line, n);
+    n = snprintf(line, sizeof(line), "mmap %zu (%zu blocks)\n", mi.hblkhd, mi.hblks);
+    write(STDERR_FILENO, line, n);
+    // 释放按块的实际大小归档，批次末尾带零头的块会记到大一档，所以各档只给次数
+    n = snprintf(line, sizeof(line), "%6s %8s %12s %12s %8s\n",
+                 "class", "size", "allocs", "frees", "cached");
+    write(STDERR_FILENO, line, n);
+    for (unsigned cls = 0; cls < CACHE_LISTS; cls++) {
+        size_t allocs, frees, cached;
+        cache_stats(cls, &allocs, &frees, &cached);
+        if (allocs == 0 && frees == 0)
+            continue;
+        // 对齐的档在大小后面加 a
+        n = snprintf(line, sizeof(line), "%6u %7zu%c %12zu %12zu %8zu\n", cls, cache_size(cls),
+                     cls < CACHE_CLASSES ? ' ' : 'a', allocs, frees, cached);
+        write(STDERR_FILENO, line, n);
+    }
+    size_t allocs = atomic_load(&shared_allocs), frees = atomic_load(&shared_frees);
+    n = snprintf(line, sizeof(line), "%6s %8s %12zu %12zu\n", "shared", "", allocs, frees);
+    write(STDERR_FILENO, line, n);
+    allocs = atomic_load(&mmap_allocs);
+    frees = atomic_load(&mmap_frees);
+    n = snprintf(line, sizeof(line), "%6s %8s %12zu %12zu\n", "mmap", "", allocs, frees);
+    write(STDERR_FILENO, line, n);
+}
+
+// 把 [lo, hi) 清零。脏内存很大时整页部分直接还给系统，再访问时由内核给零页，
+// 没用到的页也不必先缺页再写零
+static void zero_fill(char *lo, char *hi) {
+    if (RELEASE_ZEROES && hi - lo >= CALLOC_DECOMMIT_MIN) {
+        char *from = page_ceil(lo), *to = page_floor(hi);
+        memset(lo, 0, from - lo);
+        madvise(from, to - from, MADV_DONTNEED);
+        memset(to, 0, hi - to);
+    } else if (lo < hi) {
+        memset(lo, 0, hi - lo);
+    }
+}
+
+// 新映射的大块和从未用过的堆顶本来就是零，还过页的空闲块里整页部分也是零，
+// 只清零其余部分
+static void *heap_calloc(size_t size) {
+    if (size > MAX_ALLOC) {
+        return NULL;
+    }
+    thread_heap_t *heap;
+    if (size <= CACHE_MAX && (heap = heap_get()) != NULL) {
+        void *block = cache_alloc(heap, size_to_class(size));
+        if (block)
+            memset(block, 0, size);
+        return block;
+    }
+    if (use_mmap(size)) {
+        return mmap_alloc(size, 0);
+    }
+    pthread_mutex_lock(&global_malloc_lock);
+    zero_lo = zero_hi = NULL;
+    header_t *header = bin_alloc(size);
+    char *lo = zero_lo, *hi = zero_hi;
+    pthread_mutex_unlock(&global_malloc_lock);
+    atomic_fetch_add_explicit(&shared_allocs, 1, memory_order_relaxed);
+    if (!header) {
+        return NULL;
+    }
+    char *block = (char *)(header + 1), *end = block + size;
+    if (lo < block)
+        lo = block;
+    if (hi > end)
+        hi = end;
+    if (lo < hi) {
+        zero_fill(block, lo);
+        zero_fill(hi, end);
+    } else {
+        zero_fill(block, end);
+    }
+    return block;
 }
 
 void *calloc(size_t num, size_t nsize) {
-    void * block;
     size_t size;
     if (!num || !nsize)
     {
@@ -140,34 +1482,480 @@ void *calloc(size_t num, size_t nsize) {
     {
         return NULL;
     }
-    block = malloc(size);
-    if(!block) return NULL;
-    memset(block, 0, size);
-    return block;
+    return profile_account(heap_calloc(size), size);
 }
 
+// 小块走线程缓存重新分配；大一些的块先尝试原地伸缩，mmap 块用 mremap，
+// 都不行时才分配新块并复制
 void *realloc(void *block, size_t size){
-    printf("My realloc");
     header_t *header;
     void *ret;
-    if (!block || !size)
+    if (!block)
+    {
+        return profile_account(heap_alloc(size), size);
+    }
+    if (!size)
+    {
+        free(block);
+        return NULL;
+    }
+    if (size > MAX_ALLOC)
     {
         return NULL;
     }
     header = (header_t *)block - 1;
+    if (header->s.size & SAMPLED) { // 大小要变，按新分配重新采样
+        profile_forget(header);
+    }
 
-    if (header->s.size >= size) // 无需另外申请
-    {
-        return block;
+    size_t capacity = block_size(header) - sizeof(header_t);
+    if (header->s.size & IS_MMAP) {
+        if (size >= atomic_load_explicit(&mmap_threshold, memory_order_relaxed) / 2) {
+            void *p = mmap_realloc(header, size);
+            if (p) {
+                return profile_account(p, size);
+            }
+        }
+    } else if (size > CACHE_MAX) {
+        pthread_mutex_lock(&global_malloc_lock);
+        int done = heap_resize(header, align16(size) + sizeof(header_t));
+        pthread_mutex_unlock(&global_malloc_lock);
+        if (done) {
+            return profile_account(block, size);
+        }
+    } else if (capacity >= size && capacity <= CACHE_MAX) { // 无需另外申请
+        return profile_account(block, size);
     }
 
-    ret = malloc(size);
+    ret = profile_account(heap_alloc(size), size);
 
     if (ret)
     {
-        memcpy(ret, block, header->s.size);
+        memcpy(ret, block, capacity < size ? capacity : size);
         free(block);
     }
     return ret;
 
 }
+
+// 区域分配。大块从堆上 malloc，按申请顺序从新到旧串成链表；超过 chunk_size
+// 的请求单独占一个大块，挂在当前大块后面，当前大块剩下的部分照常使用。
+// arena 本身放在第一个大块的开头，reset 时留下这一块
+#define ARENA_CHUNK (64 * 1024)
+
+typedef struct arena_chunk {
+    struct arena_chunk *prev;
+    char *end;
+} arena_chunk_t;
+
+struct memalloc_arena {
+    arena_chunk_t *chunk; // 当前大块
+    char *ptr;            // 当前大块里下一个可分配的位置
+    size_t chunk_size;
+};
+
+#define ARENA_HEAD (sizeof(arena_chunk_t) + ((sizeof(memalloc_arena_t) + 15) & ~(size_t)15))
+
+memalloc_arena_t *memalloc_arena_create(size_t chunk_size) {
+    if (!chunk_size) {
+        chunk_size = ARENA_CHUNK;
+    }
+    if (chunk_size > MAX_ALLOC) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    chunk_size = align16(chunk_size);
+    arena_chunk_t *chunk = malloc(ARENA_HEAD + chunk_size);
+    if (!chunk) {
+        return NULL;
+    }
+    chunk->prev = NULL;
+    chunk->end = (char *)chunk + ARENA_HEAD + chunk_size;
+    memalloc_arena_t *arena = (memalloc_arena_t *)(chunk + 1);
+    arena->chunk = chunk;
+    arena->ptr = (char *)chunk + ARENA_HEAD;
+    arena->chunk_size = chunk_size;
+    return arena;
+}
+
+// 当前大块放不下时换一个新的，旧块剩下的部分不再使用；超大的请求单独
+// 分配，接在当前大块之后，不换当前大块
+static void *arena_grow(memalloc_arena_t *arena, size_t size) {
+    size_t len = size > arena->chunk_size ? size : arena->chunk_size;
+    arena_chunk_t *chunk = malloc(sizeof(arena_chunk_t) + len);
+    if (!chunk) {
+        return NULL;
+    }
+    chunk->end = (char *)(chunk + 1) + len;
+    if (size > arena->chunk_size) {
+        chunk->prev = arena->chunk->prev;
+        arena->chunk->prev = chunk;
+        return chunk + 1;
+    }
+    chunk->prev = arena->chunk;
+    arena->chunk = chunk;
+    arena->ptr = (char *)(chunk + 1) + size;
+    return chunk + 1;
+}
+
+void *memalloc_arena_alloc(memalloc_arena_t *arena, size_t size) {
+    if (size > MAX_ALLOC) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    size = align16(size);
+    if (size <= (size_t)(arena->chunk->end - arena->ptr)) {
+        void *p = arena->ptr;
+        arena->ptr += size;
+        return p;
+    }
+    return arena_grow(arena, size);
+}
+
+// 超大请求的大块插在当前大块后面，所以除了当前大块还要记下它后面是谁
+memalloc_arena_mark_t memalloc_arena_mark(memalloc_arena_t *arena) {
+    memalloc_arena_mark_t mark = {arena->chunk, arena->ptr, arena->chunk->prev};
+    return mark;
+}
+
+// 释放 keep 之后申请的所有大块：链表上 keep 之前的，以及之后插到 keep
+// 后面、排在 keep_prev 之前的超大块
+static void arena_release(memalloc_arena_t *arena, arena_chunk_t *keep,
+                          arena_chunk_t *keep_prev) {
+    while (arena->chunk != keep) {
+        arena_chunk_t *prev = arena->chunk->prev;
+        free(arena->chunk);
+        arena->chunk = prev;
+    }
+    while (keep->prev != keep_prev) {
+        arena_chunk_t *prev = keep->prev->prev;
+        free(keep->prev);
+        keep->prev = prev;
+    }
+}
+
+void memalloc_arena_rollback(memalloc_arena_t *arena, memalloc_arena_mark_t mark) {
+    arena_release(arena, mark.chunk, mark.prev);
+    arena->ptr = mark.ptr;
+}
+
+void memalloc_arena_reset(memalloc_arena_t *arena) {
+    arena_chunk_t *first = (arena_chunk_t *)arena - 1;
+    arena_release(arena, first, NULL);
+    arena->ptr = (char *)first + ARENA_HEAD;
+}
+
+void memalloc_arena_destroy(memalloc_arena_t *arena) {
+    memalloc_arena_reset(arena);
+    free((arena_chunk_t *)arena - 1);
+}
+
+// 定长对象池。slab 为 64K 对齐的映射，开头是 slab 头，后面紧挨着放对象，
+// 释放时按地址掩码找到所在 slab；空闲对象在 slab 内串成单链表，从未用过的
+// 部分用到时才切。每个 CPU 有两个 magazine（对象指针的小数组），分配释放
+// 只在这两个之间进出，都空或都满时才拿池锁，和池的仓库换一个满的或空的
+#define SLAB_SIZE (64 * 1024)
+#define SLAB_HEAD 64
+#define POOL_MAX_OBJECT (8 * 1024)
+#define POOL_MAX_CPUS 64
+#define MAG_SIZE 64
+#define POOL_MAGS_PER_CPU 3 // 两个挂在 CPU 上，一个先放在仓库里
+
+typedef struct pool_slab {
+    memalloc_pool_t *pool;
+    struct pool_slab *next, *prev; // 有空闲对象的 slab 串成双向链表
+    struct pool_slab *chain;       // 池里所有的 slab，销毁时用
+    void *free;
+    char *fresh;
+    unsigned used;
+} pool_slab_t;
+
+_Static_assert(sizeof(pool_slab_t) <= SLAB_HEAD, "slab header too large");
+
+typedef struct pool_magazine {
+    struct pool_magazine *next; // 在仓库里时
+    unsigned n;
+    void *obj[MAG_SIZE];
+} pool_magazine_t;
+
+// 线程可能在用到一半时被换到别的 CPU，所以缓存由 busy 标志认领；
+// 被占着时（原来的线程被抢占了）直接走池锁，不等待
+typedef struct pool_cpu {
+    _Alignas(64) atomic_int busy;
+    pool_magazine_t *loaded, *prev; // 先用 loaded，它空了或满了再与 prev 交换
+    atomic_size_t allocs, frees;    // 只有认领者写
+} pool_cpu_t;
+
+struct memalloc_pool {
+    pthread_mutex_t lock; // 保护下面的 slab 和仓库
+    size_t size;
+    unsigned per_slab, ncpu;
+    pool_slab_t *partial, *partial_tail, *slabs;
+    size_t nslabs, slab_used; // slab_used 为不在 slab 空闲链表里的对象数
+    size_t allocs, frees;     // 没拿到 CPU 缓存时的计数
+    pool_magazine_t *full, *empty; // 仓库
+    pool_cpu_t cpu[];
+};
+
+memalloc_pool_t *memalloc_pool_create(size_t size) {
+    if (size == 0 || size > POOL_MAX_OBJECT) {
+        errno = EINVAL;
+        return NULL;
+    }
+    long n = sysconf(_SC_NPROCESSORS_CONF);
+    unsigned ncpu = n < 1 ? 1 : n > POOL_MAX_CPUS ? POOL_MAX_CPUS : n;
+    size_t bytes = sizeof(memalloc_pool_t) + ncpu * sizeof(pool_cpu_t) +
+                   ncpu * POOL_MAGS_PER_CPU * sizeof(pool_magazine_t);
+    memalloc_pool_t *pool = heap_memalign(64, bytes);
+    if (!pool) {
+        return NULL;
+    }
+    memset(pool, 0, bytes);
+    pthread_mutex_init(&pool->lock, NULL);
+    pool->size = (size + 7) & ~(size_t)7;
+    pool->per_slab = (SLAB_SIZE - SLAB_HEAD) / pool->size;
+    pool->ncpu = ncpu;
+    pool_magazine_t *mags = (pool_magazine_t *)&pool->cpu[ncpu];
+    for (unsigned i = 0; i < ncpu; i++) {
+        pool->cpu[i].loaded = &mags[i * POOL_MAGS_PER_CPU];
+        pool->cpu[i].prev = &mags[i * POOL_MAGS_PER_CPU + 1];
+        for (unsigned j = 2; j < POOL_MAGS_PER_CPU; j++) {
+            mags[i * POOL_MAGS_PER_CPU + j].next = pool->empty;
+            pool->empty = &mags[i * POOL_MAGS_PER_CPU + j];
+        }
+    }
+    return pool;
+}
+
+static void slab_link(memalloc_pool_t *pool, pool_slab_t *slab) {
+    slab->prev = NULL;
+    slab->next = pool->partial;
+    if (pool->partial) {
+        pool->partial->prev = slab;
+    } else {
+        pool->partial_tail = slab;
+    }
+    pool->partial = slab;
+}
+
+// 挂到链表末尾，最后才用它
+static void slab_link_tail(memalloc_pool_t *pool, pool_slab_t *slab) {
+    slab->next = NULL;
+    slab->prev = pool->partial_tail;
+    if (pool->partial_tail) {
+        pool->partial_tail->next = slab;
+    } else {
+        pool->partial = slab;
+    }
+    pool->partial_tail = slab;
+}
+
+static void slab_unlink(memalloc_pool_t *pool, pool_slab_t *slab) {
+    if (slab->prev) {
+        slab->prev->next = slab->next;
+    } else {
+        pool->partial = slab->next;
+    }
+    if (slab->next) {
+        slab->next->prev = slab->prev;
+    } else {
+        pool->partial_tail = slab->prev;
+    }
+}
+
+// 多映射一个 slab 的大小，切掉两头得到对齐的 slab（持有池锁）
+static pool_slab_t *slab_new(memalloc_pool_t *pool) {
+    char *p = mmap(NULL, 2 * SLAB_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        return NULL;
+    }
+    char *start = (char *)(((uintptr_t)p + SLAB_SIZE - 1) & ~(uintptr_t)(SLAB_SIZE - 1));
+    if (start > p) {
+        munmap(p, start - p);
+    }
+    munmap(start + SLAB_SIZE, p + SLAB_SIZE - start);
+    pool_slab_t *slab = (pool_slab_t *)start;
+    slab->pool = pool;
+    slab->free = NULL;
+    slab->fresh = start + SLAB_HEAD;
+    slab->used = 0;
+    slab->chain = pool->slabs;
+    pool->slabs = slab;
+    pool->nslabs++;
+    slab_link(pool, slab);
+    return slab;
+}
+
+// 从 slab 取一个对象（持有池锁）
+static void *slab_take(memalloc_pool_t *pool) {
+    pool_slab_t *slab = pool->partial;
+    if (!slab && !(slab = slab_new(pool))) {
+        return NULL;
+    }
+    void *obj;
+    if (slab->free) {
+        obj = slab->free;
+        slab->free = *(void **)obj;
+    } else {
+        obj = slab->fresh;
+        slab->fresh += pool->size;
+    }
+    slab->used++;
+    pool->slab_used++;
+    if (slab->used == pool->per_slab) {
+        slab_unlink(pool, slab);
+    }
+    return obj;
+}
+
+// 对象放回所在的 slab（持有池锁）。slab 空了而还有别的 slab 可用时，
+// 把对象区的页还给系统，挪到链表末尾，先把别的 slab 用满
+static void slab_put(memalloc_pool_t *pool, void *obj) {
+    pool_slab_t *slab = (pool_slab_t *)((uintptr_t)obj & ~(uintptr_t)(SLAB_SIZE - 1));
+    if (slab->used == pool->per_slab) {
+        slab_link(pool, slab);
+    }
+    *(void **)obj = slab->free;
+    slab->free = obj;
+    slab->used--;
+    pool->slab_used--;
+    if (slab->used == 0 && (slab->next || slab->prev)) {
+        size_t page = sysconf(_SC_PAGESIZE);
+        madvise((char *)slab + page, SLAB_SIZE - page, MADV_RELEASE);
+        slab->free = NULL;
+        slab->fresh = (char *)slab + SLAB_HEAD;
+        slab_unlink(pool, slab);
+        slab_link_tail(pool, slab);
+    }
+}
+
+static pool_cpu_t *pool_cpu_get(memalloc_pool_t *pool) {
+    int cpu = sched_getcpu();
+    pool_cpu_t *c = &pool->cpu[cpu > 0 ? (unsigned)cpu % pool->ncpu : 0];
+    if (atomic_exchange_explicit(&c->busy, 1, memory_order_acquire)) {
+        return NULL;
+    }
+    return c;
+}
+
+static void pool_cpu_put(pool_cpu_t *c) {
+    atomic_store_explicit(&c->busy, 0, memory_order_release);
+}
+
+// loaded 和 prev 都空了：从仓库换一个满的回来，仓库没有就从 slab 装满 prev
+static void mag_reload(memalloc_pool_t *pool, pool_cpu_t *c) {
+    pthread_mutex_lock(&pool->lock);
+    pool_magazine_t *full = pool->full;
+    if (full) {
+        pool->full = full->next;
+        c->prev->next = pool->empty;
+        pool->empty = c->prev;
+        c->prev = full;
+    } else {
+        pool_magazine_t *m = c->prev;
+        void *obj;
+        while (m->n < MAG_SIZE && (obj = slab_take(pool)) != NULL)
+            m->obj[m->n++] = obj;
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// loaded 和 prev 都满了：把 prev 放进仓库换一个空的，仓库没有空的就把 prev 倒回 slab
+static void mag_unload(memalloc_pool_t *pool, pool_cpu_t *c) {
+    pthread_mutex_lock(&pool->lock);
+    pool_magazine_t *empty = pool->empty;
+    if (empty) {
+        pool->empty = empty->next;
+        c->prev->next = pool->full;
+        pool->full = c->prev;
+        c->prev = empty;
+    } else {
+        pool_magazine_t *m = c->prev;
+        while (m->n > 0)
+            slab_put(pool, m->obj[--m->n]);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void *memalloc_pool_alloc(memalloc_pool_t *pool) {
+    pool_cpu_t *c = pool_cpu_get(pool);
+    if (!c) {
+        pthread_mutex_lock(&pool->lock);
+        void *obj = slab_take(pool);
+        pool->allocs += obj != NULL;
+        pthread_mutex_unlock(&pool->lock);
+        return obj;
+    }
+    pool_magazine_t *m = c->loaded;
+    if (m->n == 0) {
+        if (c->prev->n == 0) {
+            mag_reload(pool, c);
+        }
+        c->loaded = c->prev;
+        c->prev = m;
+        m = c->loaded;
+        if (m->n == 0) {
+            pool_cpu_put(c);
+            errno = ENOMEM;
+            return NULL;
+        }
+    }
+    void *obj = m->obj[--m->n];
+    stat_inc(&c->allocs);
+    pool_cpu_put(c);
+    return obj;
+}
+
+void memalloc_pool_free(memalloc_pool_t *pool, void *obj) {
+    if (!obj) {
+        return;
+    }
+    pool_cpu_t *c = pool_cpu_get(pool);
+    if (!c) {
+        pthread_mutex_lock(&pool->lock);
+        slab_put(pool, obj);
+        pool->frees++;
+        pthread_mutex_unlock(&pool->lock);
+        return;
+    }
+    pool_magazine_t *m = c->loaded;
+    if (m->n == MAG_SIZE) {
+        if (c->prev->n == MAG_SIZE) {
+            mag_unload(pool, c);
+        }
+        c->loaded = c->prev;
+        c->prev = m;
+        m = c->loaded;
+    }
+    m->obj[m->n++] = obj;
+    stat_inc(&c->frees);
+    pool_cpu_put(c);
+}
+
+void memalloc_pool_stats(memalloc_pool_t *pool, memalloc_pool_stats_t *stats) {
+    pthread_mutex_lock(&pool->lock);
+    size_t allocs = pool->allocs, frees = pool->frees;
+    for (unsigned i = 0; i < pool->ncpu; i++) {
+        allocs += atomic_load_explicit(&pool->cpu[i].allocs, memory_order_relaxed);
+        frees += atomic_load_explicit(&pool->cpu[i].frees, memory_order_relaxed);
+    }
+    stats->object_size = pool->size;
+    stats->slabs = pool->nslabs;
+    stats->capacity = pool->nslabs * pool->per_slab;
+    stats->allocs = allocs;
+    stats->frees = frees;
+    stats->in_use = allocs > frees ? allocs - frees : 0;
+    stats->cached = pool->slab_used > stats->in_use ? pool->slab_used - stats->in_use : 0;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void memalloc_pool_destroy(memalloc_pool_t *pool) {
+    pool_slab_t *slab = pool->slabs;
+    while (slab) {
+        pool_slab_t *chain = slab->chain;
+        munmap(slab, SLAB_SIZE);
+        slab = chain;
+    }
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+}
@@ -0,0 +1,54 @@
+// memalloc 在标准分配接口之外提供的扩展接口。malloc/free 等直接替换 libc，
+// 不在这里声明；使用这些扩展的程序需要链接 libmemalloc.so
+#ifndef MEMALLOC_H
+#define MEMALLOC_H
+
+#include <stddef.h>
+
+// 区域分配：一批生命周期相同的小对象（一条命令行、一帧画面）从大块里顺序
+// 切出，分配只是移动指针，不能单独释放，reset 或 destroy 时一起释放。
+// 不加锁，一个 arena 同一时间只能由一个线程使用
+typedef struct memalloc_arena memalloc_arena_t;
+
+// 记录当前分配位置，rollback 回到这里，之后分配的对象全部作废
+typedef struct memalloc_arena_mark {
+    void *chunk;
+    char *ptr;
+    void *prev;
+} memalloc_arena_mark_t;
+
+// chunk_size 为每次向堆申请的大块大小，0 表示默认的 64K。失败返回 NULL
+memalloc_arena_t *memalloc_arena_create(size_t chunk_size);
+// 返回 16 字节对齐的 size 字节；超过 chunk_size 的请求单独占一个大块，
+// 不影响之后的小对象继续用当前大块
+void *memalloc_arena_alloc(memalloc_arena_t *arena, size_t size);
+memalloc_arena_mark_t memalloc_arena_mark(memalloc_arena_t *arena);
+void memalloc_arena_rollback(memalloc_arena_t *arena, memalloc_arena_mark_t mark);
+// 释放所有对象，只保留第一个大块，耗时与大块数成正比
+void memalloc_arena_reset(memalloc_arena_t *arena);
+void memalloc_arena_destroy(memalloc_arena_t *arena);
+
+// 定长对象池：同一尺寸的对象（行结构、链表节点）紧挨着放在 slab 里，
+// 同尺寸的分配释放在每个 CPU 的缓存里完成，不经过通用堆也不加锁。
+// 池内的对象只能用 memalloc_pool_free 释放，可以在任意线程释放
+typedef struct memalloc_pool memalloc_pool_t;
+
+typedef struct memalloc_pool_stats {
+    size_t object_size; // 对齐后的对象大小
+    size_t slabs;       // 已映射的 slab 数
+    size_t capacity;    // 这些 slab 能放下的对象数
+    size_t in_use;      // 已分配出去的对象数
+    size_t cached;      // 在各 CPU 缓存和仓库里等待重用的对象数
+    size_t allocs, frees;
+} memalloc_pool_stats_t;
+
+// size 不超过 8K，按 8 字节取整；16 的倍数的对象按 16 字节对齐。失败返回 NULL
+memalloc_pool_t *memalloc_pool_create(size_t size);
+void *memalloc_pool_alloc(memalloc_pool_t *pool);
+void memalloc_pool_free(memalloc_pool_t *pool, void *obj);
+// 计数不与分配释放同步，并发时是近似值
+void memalloc_pool_stats(memalloc_pool_t *pool, memalloc_pool_stats_t *stats);
+// 连同未释放的对象一起归还系统
+void memalloc_pool_destroy(memalloc_pool_t *pool);
+
+#endif
@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/wait.h>
 #include <unistd.h>
 #define SH_READLINE_BUFSIZE 1024;
 #define SH_READARGS_BUFSIZE 1024;
@@ -0,0 +1,36 @@
+// 对齐分配的参数检查与结果：posix_memalign 的对齐必须是 sizeof(void *) 的
+// 2 的幂倍，否则返回 EINVAL 且不改 *memptr；合法时返回的块按要求对齐
+#include "../memalloc.c"
+
+static int failures;
+
+static void check(int ok, const char *what, size_t alignment) {
+    if (!ok) {
+        printf("aligned: %s (alignment %zu)\n", what, alignment);
+        failures++;
+    }
+}
+
+int main(void) {
+    static const size_t bad[] = {0, 1, 2, 4, 12, 24, 48, 100, 4097};
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+        void *p = &failures;
+        int err = posix_memalign(&p, bad[i], 64);
+        check(err == EINVAL, "bad alignment not rejected with EINVAL", bad[i]);
+        check(p == &failures, "memptr changed on error", bad[i]);
+    }
+    for (size_t align = sizeof(void *); align <= 1 << 20; align <<= 1) {
+        static const size_t sizes[] = {0, 1, 100, 5000, 300000};
+        for (size_t j = 0; j < sizeof(sizes) / sizeof(sizes[0]); j++) {
+            void *p = NULL;
+            int err = posix_memalign(&p, align, sizes[j]);
+            check(err == 0, "valid alignment failed", align);
+            check((uintptr_t)p % align == 0, "result not aligned", align);
+            if (p != NULL)
+                memset(p, 0xAB, sizes[j]);
+            free(p);
+        }
+    }
+    printf("aligned: %d failures\n", failures);
+    return failures > 0;
+}
@@ -0,0 +1,51 @@
+// 区域分配里超过 chunk_size 的请求单独占一个大块：之后的小对象仍从当前大块
+// 接着切；rollback、reset 和 destroy 都要把这些大块还回去
+#include "../memalloc.c"
+
+#define BIG (40 << 20) // 超过 MMAP_THRESHOLD_MAX，总是单独映射，可以按映射数清点
+
+static int failures;
+
+static void check(int ok, const char *what) {
+    if (!ok) {
+        printf("arena: %s\n", what);
+        failures++;
+    }
+}
+
+static size_t mapped(void) {
+    return atomic_load(&mmap_allocs) - atomic_load(&mmap_frees);
+}
+
+int main(void) {
+    size_t base = mapped();
+    memalloc_arena_t *arena = memalloc_arena_create(4096);
+    char *a = memalloc_arena_alloc(arena, 64);
+    char *big = memalloc_arena_alloc(arena, BIG);
+    char *b = memalloc_arena_alloc(arena, 64);
+    check(big != NULL && mapped() == base + 1, "big allocation not in its own chunk");
+    check(b == a + 64, "small allocation after a big one left the current chunk");
+
+    // 在当前大块和之后换上的新大块后面都挂上超大块，rollback 要全部释放
+    memalloc_arena_mark_t mark = memalloc_arena_mark(arena);
+    memalloc_arena_alloc(arena, BIG);
+    for (int i = 0; i < 200; i++)
+        memalloc_arena_alloc(arena, 100);
+    memalloc_arena_alloc(arena, BIG);
+    check(mapped() == base + 3, "big allocations after the mark not mapped");
+    memalloc_arena_rollback(arena, mark);
+    check(mapped() == base + 1, "rollback kept big chunks allocated after the mark");
+    char *c = memalloc_arena_alloc(arena, 64);
+    check(c == b + 64, "rollback did not restore the allocation position");
+    memset(big, 0xAB, 4096); // mark 之前的超大块仍然可用
+
+    memalloc_arena_reset(arena);
+    check(mapped() == base, "reset kept big chunks");
+    check(memalloc_arena_alloc(arena, 64) == a, "reset did not rewind the first chunk");
+    memalloc_arena_alloc(arena, BIG);
+    memalloc_arena_destroy(arena);
+    check(mapped() == base, "destroy kept big chunks");
+
+    printf("arena: %d failures\n", failures);
+    return failures > 0;
+}
@@ -0,0 +1,83 @@
+// 线程缓存补充与相邻块释放的竞争：cache_refill 放开全局锁之后，让另一个线程
+// 释放紧挨在这一批前面的块。释放在锁内给这一批的第一个块头设上 PREV_FREE，
+// 补充的线程之后不能把它冲掉，否则这个空闲块再也不会和后面的块合并。
+// 直接把 memalloc.c 编进来，用 CACHE_REFILL_HOOK 卡住这个时间窗口
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <semaphore.h>
+
+static void refill_hook(void *header);
+#define CACHE_REFILL_HOOK(header) refill_hook(header)
+#include "../memalloc.c"
+
+#define ROUNDS 32
+#define VICTIM_SIZE 2000 // 大于 CACHE_MAX，释放时直接回到共享堆
+
+// 编译器认为 malloc 不读写这些变量，都要 volatile
+static void *volatile victim;    // 数据区紧挨着下一批的块，由 freer 线程释放
+static header_t *volatile batch; // 被卡住的那一批的第一个块
+static void *volatile sink;      // 否则成对的 malloc/free 会被整个删掉
+static sem_t go, done;
+static int hits, failures;
+
+static void refill_hook(void *header) {
+    if (victim == NULL || next_block((header_t *)victim - 1) != header) {
+        return;
+    }
+    batch = header;
+    sem_post(&go);
+    sem_wait(&done);
+}
+
+static void *freer_main(void *arg) {
+    (void)arg;
+    while (1) {
+        sem_wait(&go);
+        if (victim == NULL) {
+            return NULL;
+        }
+        free(victim);
+        sem_post(&done);
+    }
+}
+
+// 每个新线程的缓存都是空的，每档第一次分配都会补充
+static void *worker_main(void *arg) {
+    (void)arg;
+    for (size_t size = 16; size <= CACHE_MAX; size += 16) {
+        void *p = sink = malloc(VICTIM_SIZE);
+        victim = p;
+        batch = NULL;
+        void *q = sink = malloc(size);
+        victim = NULL;
+        if (batch == NULL) {
+            free(p);
+        } else {
+            hits++;
+            pthread_mutex_lock(&global_malloc_lock);
+            header_t *prev = (header_t *)((char *)batch - batch->s.prev_size);
+            if (!(batch->s.size & PREV_FREE) || !(prev->s.size & BLOCK_FREE) ||
+                block_size(prev) != batch->s.prev_size) {
+                failures++;
+            }
+            pthread_mutex_unlock(&global_malloc_lock);
+        }
+        free(q);
+    }
+    return NULL;
+}
+
+int main(void) {
+    pthread_t freer, worker;
+    sem_init(&go, 0, 0);
+    sem_init(&done, 0, 0);
+    pthread_create(&freer, NULL, freer_main, NULL);
+    for (int round = 0; round < ROUNDS; round++) {
+        pthread_create(&worker, NULL, worker_main, NULL);
+        pthread_join(worker, NULL);
+    }
+    sem_post(&go);
+    pthread_join(freer, NULL);
+    printf("refill_race: %d refills next to a freed block, %d lost PREV_FREE\n", hits, failures);
+    return hits == 0 || failures > 0;
+}